@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+#include "entity.hpp"
+#include "constraint.hpp"
+#include "equation_system.hpp"
+#include "dense_kernels.hpp"
+
+// Scaling benchmark for the solver phases on synthetic sketches.
+//
+// usage: adjacent_bench [--max N] [--budget SECONDS] [--out FILE]
+//
+// Every generator is run for a ladder of sketch sizes (number of constraints, 10 up to
+// --max). A generator stops climbing the ladder once one size took longer than --budget.
+// After the solve one point is dragged around a small circle for drag_frames frames and the
+// per-frame latency of update_drag is summarized as percentiles and a histogram.
+// Results are written as JSON to FILE (default adjacent_bench.json, "-" for stdout); the
+// solver's own diagnostics go to stdout as well.
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    std::shared_ptr<PointE> point(double x, double y)
+    {
+        return std::make_shared<PointE>(param("x", x), param("y", y), param("z", 0.0));
+    }
+
+    // A polyline of segments sharing their end points. Segments alternate between horizontal
+    // and vertical and every one gets a length, so about two constraints per segment.
+    std::unique_ptr<Sketch> line_chain(std::size_t n_constraints)
+    {
+        auto sketch = std::make_unique<Sketch>();
+        std::size_t segments = std::max<std::size_t>(1, n_constraints / 2);
+        auto prev = point(0.0, 0.0);
+        for (std::size_t i = 0; i < segments; i++)
+        {
+            bool horizontal = i % 2 == 0;
+            auto next = point(prev->x->value() + (horizontal ? 1.1 : 0.2),
+                              prev->y->value() + (horizontal ? 0.15 : 0.9));
+            auto line = std::make_shared<LineE>(*prev, *next);
+            sketch->add_entity(line);
+            sketch->add_constraint(std::make_shared<HVConstraint>(line, horizontal ? OY : OX));
+            sketch->add_constraint(std::make_shared<LengthConstraint>(line, 1.0));
+            prev = next;
+        }
+        return sketch;
+    }
+
+    // A k x k grid of points joined by horizontal and vertical lines, like a sheet of
+    // rectangles. Rows and columns are kept straight and the first row and column get lengths.
+    std::unique_ptr<Sketch> rectangle_grid(std::size_t n_constraints)
+    {
+        auto sketch = std::make_unique<Sketch>();
+        std::size_t k = 2;
+        while (2 * k * (k - 1) + 2 * (k - 1) < n_constraints)
+            k++;
+
+        std::vector<std::shared_ptr<PointE>> points;
+        for (std::size_t r = 0; r < k; r++)
+        {
+            for (std::size_t c = 0; c < k; c++)
+                points.push_back(point(c * 1.05 + 0.03 * r, r * 0.95 + 0.02 * c));
+        }
+
+        for (std::size_t r = 0; r < k; r++)
+        {
+            for (std::size_t c = 0; c < k; c++)
+            {
+                if (c + 1 < k)
+                {
+                    auto line = std::make_shared<LineE>(*points[r * k + c], *points[r * k + c + 1]);
+                    sketch->add_entity(line);
+                    sketch->add_constraint(std::make_shared<HVConstraint>(line, OY));
+                    if (r == 0)
+                        sketch->add_constraint(std::make_shared<LengthConstraint>(line, 1.0));
+                }
+                if (r + 1 < k)
+                {
+                    auto line =
+                        std::make_shared<LineE>(*points[r * k + c], *points[(r + 1) * k + c]);
+                    sketch->add_entity(line);
+                    sketch->add_constraint(std::make_shared<HVConstraint>(line, OX));
+                    if (c == 0)
+                        sketch->add_constraint(std::make_shared<LengthConstraint>(line, 1.0));
+                }
+            }
+        }
+        return sketch;
+    }
+
+    // Circles on a lattice, each with a vertical line tangent to its right side, a diameter
+    // and a distance to its left neighbour. Four constraints per circle.
+    std::unique_ptr<Sketch> circle_tangent_lattice(std::size_t n_constraints)
+    {
+        auto sketch = std::make_unique<Sketch>();
+        std::size_t circles = std::max<std::size_t>(1, n_constraints / 4);
+        std::size_t k = 1;
+        while (k * k < circles)
+            k++;
+
+        std::vector<std::shared_ptr<PointE>> centers;
+        for (std::size_t i = 0; i < circles; i++)
+        {
+            double cx = (i % k) * 3.0;
+            double cy = (i / k) * 3.0;
+            auto center = point(cx, cy);
+            EntityPtr circle = std::make_shared<CircleE>(*center, param("r", 1.1));
+            auto line = std::make_shared<LineE>(*point(cx + 1.05, cy - 1.0),
+                                                *point(cx + 1.1, cy + 1.0));
+            sketch->add_entity(circle);
+            sketch->add_entity(line);
+            sketch->add_constraint(std::make_shared<DiameterConstraint>(circle, 2.0));
+            sketch->add_constraint(std::make_shared<HVConstraint>(line, OX));
+
+            auto c = std::static_pointer_cast<CircleE>(circle);
+            auto tangent = std::make_shared<TangentConstraint>(c, line);
+            tangent->t0->set_value(0.0);
+            tangent->t1->set_value(0.5);
+            sketch->add_constraint(tangent);
+
+            if (i % k != 0)
+            {
+                sketch->add_constraint(
+                    std::make_shared<PointsDistanceConstraint>(centers.back(), center, 3.0));
+            }
+            centers.push_back(center);
+        }
+        return sketch;
+    }
+
+    // Free points each held on one of a few lines, so most constraints are PointOn.
+    std::unique_ptr<Sketch> point_on_heavy(std::size_t n_constraints)
+    {
+        auto sketch = std::make_unique<Sketch>();
+        std::size_t lines = std::max<std::size_t>(1, n_constraints / 50);
+        std::vector<std::shared_ptr<LineE>> carriers;
+        for (std::size_t i = 0; i < lines; i++)
+        {
+            auto line = std::make_shared<LineE>(*point(0.0, i * 2.0), *point(10.0, i * 2.0 + 1.0));
+            sketch->add_entity(line);
+            carriers.push_back(line);
+        }
+
+        std::size_t points = n_constraints > lines ? n_constraints - lines : 1;
+        for (std::size_t i = 0; i < points; i++)
+        {
+            auto& line = carriers[i % lines];
+            double t = (i / lines + 0.5) / (points / lines + 1.0);
+            auto p = point(10.0 * t + 0.05, (i % lines) * 2.0 + t + 0.1);
+            sketch->add_entity(p);
+            sketch->add_constraint(std::make_shared<PointOnConstraint>(p, line));
+        }
+        for (auto& line : carriers)
+            sketch->add_constraint(std::make_shared<LengthConstraint>(line, 10.0));
+        return sketch;
+    }
+
+    const int drag_frames = 60;
+    // upper bounds of the drag latency histogram buckets, the last one catches the rest
+    const double drag_buckets_ms[] = { 0.05, 0.1, 0.25, 0.5, 1.0, 2.0, 5.0, 10.0, INFINITY };
+    const std::size_t n_drag_buckets = sizeof(drag_buckets_ms) / sizeof(drag_buckets_ms[0]);
+
+    struct Generator
+    {
+        const char* name;
+        std::function<std::unique_ptr<Sketch>(std::size_t)> make;
+    };
+
+    struct Measurement
+    {
+        std::string generator;
+        std::size_t target = 0;
+        std::size_t constraints = 0;
+        std::size_t equations = 0;
+        std::size_t unknowns = 0;
+        int result = 0;
+        double build_seconds = 0.0;
+        double update_seconds = 0.0;
+        double update_dirty_seconds = 0.0;
+        double write_jacobian_seconds = 0.0;
+        double eval_jacobian_seconds = 0.0;
+        double least_squares_seconds = 0.0;
+
+        double drag_begin_seconds = 0.0;
+        std::vector<double> drag_frame_seconds;
+        int drag_failures = 0;
+    };
+
+    // some point of the sketch, endpoints of lines share their params with the line
+    std::shared_ptr<PointE> drag_handle(Sketch& sketch)
+    {
+        for (const auto& e : sketch.entities)
+        {
+            if (auto p = std::dynamic_pointer_cast<PointE>(e))
+                return p;
+            if (auto l = std::dynamic_pointer_cast<LineE>(e))
+                return std::make_shared<PointE>(l->p1);
+        }
+        return nullptr;
+    }
+
+    double percentile(std::vector<double> v, double q)
+    {
+        if (v.empty())
+            return 0.0;
+        std::sort(v.begin(), v.end());
+        return v[std::min(v.size() - 1, std::size_t(q * v.size()))];
+    }
+
+    template <class F>
+    double time_it(F&& f)
+    {
+        auto start = clock::now();
+        f();
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    Measurement measure(const Generator& generator, std::size_t n)
+    {
+        Measurement m;
+        m.generator = generator.name;
+        m.target = n;
+
+        std::unique_ptr<Sketch> sketch;
+        m.build_seconds = time_it([&] { sketch = generator.make(n); });
+        m.constraints = sketch->constraints.size();
+
+        // the individual phases run on a fresh system so they see the unsolved sketch
+        EquationSystem sys;
+        sketch->generate_equations(sys);
+        m.update_dirty_seconds = time_it([&] { sys.update_dirty(); });
+        m.equations = sys.equations.size();
+        m.unknowns = sys.current_params.size();
+
+        // large systems go through the matrix-free solver, J and A are never formed for them
+        if (sys.sparse)
+        {
+            m.write_jacobian_seconds = time_it([&] { sys.write_sparse_jacobian(); });
+            m.eval_jacobian_seconds = time_it([&] { sys.eval_sparse_jacobian(false); });
+            sys.eval(sys.B, false);
+            m.least_squares_seconds = time_it([&] { sys.solve_lsqr(sys.B, sys.X); });
+        }
+        else
+        {
+            m.write_jacobian_seconds =
+                time_it([&] { sys.write_jacobian(sys.equations, sys.current_params); });
+            m.eval_jacobian_seconds = time_it([&] { sys.eval_jacobian(sys.J, sys.A, false); });
+            sys.eval(sys.B, false);
+            m.least_squares_seconds =
+                time_it([&] { sys.solve_least_squares(sys.A, sys.B, sys.X); });
+        }
+
+        m.update_seconds = time_it([&] { m.result = sketch->update(); });
+
+        if (auto p = drag_handle(*sketch))
+        {
+            double x = p->x->value();
+            double y = p->y->value();
+            m.drag_begin_seconds = time_it([&] { sketch->begin_drag(p); });
+            for (int f = 1; f <= drag_frames; f++)
+            {
+                double angle = 2.0 * M_PI * f / drag_frames;
+                double tx = x + 0.2 * std::sin(angle);
+                double ty = y + 0.2 - 0.2 * std::cos(angle);
+                m.drag_frame_seconds.push_back(time_it([&] {
+                    if (sketch->update_drag(tx, ty) != OKAY)
+                        m.drag_failures++;
+                }));
+            }
+            sketch->end_drag();
+        }
+        return m;
+    }
+
+    void write_json(std::ostream& os, const std::vector<Measurement>& results)
+    {
+        os << "{\n  \"dense_backend\": \"" << make_dense_backend()->name() << "\",\n";
+        os << "  \"dense_kernels\": \"" << dense_kernels().isa << "\",\n";
+        os << "  \"drag_histogram_bounds_ms\": [";
+        for (std::size_t b = 0; b + 1 < n_drag_buckets; b++)
+            os << (b == 0 ? "" : ", ") << drag_buckets_ms[b];
+        os << "],\n  \"results\": [";
+        for (std::size_t i = 0; i < results.size(); i++)
+        {
+            const auto& m = results[i];
+            os << (i == 0 ? "\n" : ",\n") << "    {\"generator\": \"" << m.generator
+               << "\", \"target\": " << m.target << ", \"constraints\": " << m.constraints
+               << ", \"equations\": " << m.equations << ", \"unknowns\": " << m.unknowns
+               << ", \"result\": " << m.result << ", \"build\": " << m.build_seconds
+               << ", \"update\": " << m.update_seconds
+               << ", \"update_dirty\": " << m.update_dirty_seconds
+               << ", \"write_jacobian\": " << m.write_jacobian_seconds
+               << ", \"eval_jacobian\": " << m.eval_jacobian_seconds
+               << ", \"solve_least_squares\": " << m.least_squares_seconds
+               << ", \"drag_begin\": " << m.drag_begin_seconds
+               << ", \"drag_frames\": " << m.drag_frame_seconds.size()
+               << ", \"drag_failures\": " << m.drag_failures
+               << ", \"drag_p50\": " << percentile(m.drag_frame_seconds, 0.5)
+               << ", \"drag_p95\": " << percentile(m.drag_frame_seconds, 0.95)
+               << ", \"drag_max\": " << percentile(m.drag_frame_seconds, 1.0)
+               << ", \"drag_histogram\": [";
+            std::vector<std::size_t> histogram(n_drag_buckets, 0);
+            for (double seconds : m.drag_frame_seconds)
+            {
+                std::size_t b = 0;
+                while (seconds * 1e3 > drag_buckets_ms[b])
+                    b++;
+                histogram[b]++;
+            }
+            for (std::size_t b = 0; b < n_drag_buckets; b++)
+                os << (b == 0 ? "" : ", ") << histogram[b];
+            os << "]}";
+        }
+        os << "\n  ]\n}\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t max_constraints = 10000;
+    double budget = 30.0;
+    std::string out_path = "adjacent_bench.json";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--max") == 0 && i + 1 < argc)
+            max_constraints = std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+            budget = std::strtod(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--max N] [--budget SECONDS] [--out FILE]\n";
+            return 1;
+        }
+    }
+
+    const std::vector<Generator> generators = {
+        { "line_chain", line_chain },
+        { "rectangle_grid", rectangle_grid },
+        { "circle_tangent_lattice", circle_tangent_lattice },
+        { "point_on_heavy", point_on_heavy },
+    };
+    const std::size_t ladder[] = { 10, 30, 100, 300, 1000, 3000, 10000 };
+
+    std::vector<Measurement> results;
+    for (const auto& generator : generators)
+    {
+        for (std::size_t n : ladder)
+        {
+            if (n > max_constraints)
+                break;
+            double seconds = time_it([&] { results.push_back(measure(generator, n)); });
+            std::cerr << generator.name << " " << n << ": " << seconds << " s\n";
+            if (seconds > budget)
+                break;
+        }
+    }
+
+    if (out_path == "-")
+    {
+        write_json(std::cout, results);
+    }
+    else
+    {
+        std::ofstream file(out_path);
+        write_json(file, results);
+    }
+    return 0;
+}
@@ -0,0 +1,409 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "expression.hpp"
+
+// Micro-benchmarks of the Expr layer: construction through the operators, eval by op mix and
+// depth, d (time and size of the result), substitute/substituted and to_string.
+//
+// usage: adjacent_expr_bench [--baseline FILE] [--write-baseline FILE] [--tolerance X] [--sizes]
+//
+// Times are reported relative to a reference interpreter built into this file (a bare
+// shared_ptr tree evaluated with a switch), so a baseline recorded on one machine is usable
+// on another. Against --baseline a case fails when its relative time grows by more than
+// the tolerance factor (default 2.5) or when a size metric (node count, string length)
+// grows at all. The exit code is non-zero if any case fails. --sizes skips the timing and only
+// checks the size metrics, which don't depend on the machine or its load.
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    // off with --sizes, cases then only run once for their size metrics
+    bool timed = true;
+
+    // deterministic so that the size metrics are exact across runs and platforms
+    struct Lcg
+    {
+        unsigned state = 12345;
+        unsigned next(unsigned n)
+        {
+            state = state * 1103515245u + 12345u;
+            return (state >> 16) % n;
+        }
+    };
+
+    std::vector<ParamPtr> make_params(std::size_t n)
+    {
+        std::vector<ParamPtr> params;
+        for (std::size_t i = 0; i < n; i++)
+            params.push_back(param("p" + std::to_string(i), 0.1 + 0.01 * i));
+        return params;
+    }
+
+    // balanced tree of Add/Sub/Mul over params
+    ExprPtr arith_tree(const std::vector<ParamPtr>& params, int depth, Lcg& rng)
+    {
+        if (depth == 0)
+            return params[rng.next(params.size())]->expr();
+        auto a = arith_tree(params, depth - 1, rng);
+        auto b = arith_tree(params, depth - 1, rng);
+        switch (rng.next(3))
+        {
+            case 0:
+                return a + b;
+            case 1:
+                return a - b;
+        }
+        return a * b;
+    }
+
+    // balanced tree mixing arithmetic with the transcendental ops the constraints use
+    ExprPtr mixed_tree(const std::vector<ParamPtr>& params, int depth, Lcg& rng)
+    {
+        if (depth == 0)
+            return params[rng.next(params.size())]->expr();
+        auto a = mixed_tree(params, depth - 1, rng);
+        switch (rng.next(8))
+        {
+            case 0:
+                return sin(a);
+            case 1:
+                return cos(a);
+            case 2:
+                return sqrt(sqr(a) + one);
+        }
+        auto b = mixed_tree(params, depth - 1, rng);
+        switch (rng.next(4))
+        {
+            case 0:
+                return a + b;
+            case 1:
+                return a * b;
+            case 2:
+                return a / (sqr(b) + two);
+        }
+        return atan2(a, b);
+    }
+
+    // sum of n params built left to right, i.e. a chain of depth n
+    ExprPtr add_chain(const std::vector<ParamPtr>& params, std::size_t n)
+    {
+        ExprPtr sum = params[0]->expr();
+        for (std::size_t i = 1; i < n; i++)
+            sum = sum + params[i % params.size()]->expr();
+        return sum;
+    }
+
+    std::size_t count_nodes(const ExprPtr& e, std::unordered_set<const Expr*>& visited)
+    {
+        if (e == nullptr || !visited.insert(e.get()).second)
+            return 0;
+        return 1 + count_nodes(e->a, visited) + count_nodes(e->b, visited);
+    }
+
+    std::size_t count_nodes(const ExprPtr& e)
+    {
+        std::unordered_set<const Expr*> visited;
+        return count_nodes(e, visited);
+    }
+
+    // the reference the timings are normalized against
+    struct RefNode
+    {
+        int op;
+        double value;
+        std::shared_ptr<RefNode> a, b;
+    };
+
+    double ref_eval(const RefNode* n)
+    {
+        switch (n->op)
+        {
+            case 0:
+                return n->value;
+            case 1:
+                return ref_eval(n->a.get()) + ref_eval(n->b.get());
+            case 2:
+                return ref_eval(n->a.get()) - ref_eval(n->b.get());
+        }
+        return ref_eval(n->a.get()) * ref_eval(n->b.get());
+    }
+
+    std::shared_ptr<RefNode> ref_tree(int depth, Lcg& rng)
+    {
+        auto n = std::make_shared<RefNode>();
+        if (depth == 0)
+        {
+            n->op = 0;
+            n->value = 0.1 + 0.01 * rng.next(32);
+            return n;
+        }
+        n->a = ref_tree(depth - 1, rng);
+        n->b = ref_tree(depth - 1, rng);
+        n->op = 1 + rng.next(3);
+        return n;
+    }
+
+    // best of several runs of the seconds per call of `f`, each run at least ~10ms long
+    double seconds_per_call(const std::function<void()>& f)
+    {
+        if (!timed)
+        {
+            f();
+            return 0.0;
+        }
+        double best = 0.0;
+        for (int run = 0; run < 5; run++)
+        {
+            std::size_t calls = 0;
+            auto start = clock::now();
+            double elapsed = 0.0;
+            do
+            {
+                f();
+                calls++;
+                elapsed = std::chrono::duration<double>(clock::now() - start).count();
+            } while (elapsed < 0.01);
+            double per_call = elapsed / calls;
+            if (run == 0 || per_call < best)
+                best = per_call;
+        }
+        return best;
+    }
+
+    volatile double sink;
+
+    double reference_unit()
+    {
+        Lcg rng;
+        auto tree = ref_tree(10, rng);
+        std::function<void()> construct = [] {
+            Lcg rng;
+            sink = ref_tree(10, rng)->value;
+        };
+        std::function<void()> eval = [&] { sink = ref_eval(tree.get()); };
+        // one unit is a build plus an eval of a 2047 node tree
+        return seconds_per_call(construct) + seconds_per_call(eval);
+    }
+
+    struct Case
+    {
+        std::string name;
+        std::map<std::string, double> metrics;
+    };
+
+    std::vector<Case> run_cases()
+    {
+        auto params = make_params(16);
+        std::vector<Case> cases;
+        auto add = [&](const std::string& name, std::map<std::string, double> metrics) {
+            if (!timed)
+                metrics.erase("time");
+            if (metrics.empty())
+                return;
+            cases.push_back({ name, metrics });
+            std::cerr << ".";
+        };
+
+        for (int depth : { 6, 10 })
+        {
+            auto construct = [&] {
+                Lcg rng;
+                arith_tree(params, depth, rng);
+            };
+            add("construct_arith_d" + std::to_string(depth),
+                { { "time", seconds_per_call(construct) } });
+        }
+        add("construct_chain_1000",
+            { { "time", seconds_per_call([&] { add_chain(params, 1000); }) } });
+
+        for (int depth : { 6, 10 })
+        {
+            Lcg rng;
+            auto e = arith_tree(params, depth, rng);
+            add("eval_arith_d" + std::to_string(depth),
+                { { "time", seconds_per_call([&] { sink = e->eval(); }) },
+                  { "nodes", (double) count_nodes(e) } });
+        }
+        {
+            Lcg rng;
+            auto e = mixed_tree(params, 10, rng);
+            add("eval_mixed_d10", { { "time", seconds_per_call([&] { sink = e->eval(); }) },
+                                    { "nodes", (double) count_nodes(e) } });
+        }
+        {
+            auto e = add_chain(params, 1000);
+            add("eval_chain_1000", { { "time", seconds_per_call([&] { sink = e->eval(); }) } });
+        }
+
+        for (int depth : { 6, 8 })
+        {
+            Lcg rng;
+            auto e = mixed_tree(params, depth, rng);
+            auto p = params[3];
+            add("d_mixed_d" + std::to_string(depth),
+                { { "time", seconds_per_call([&] { e->d(p); }) },
+                  { "nodes", (double) count_nodes(e->d(p)) } });
+        }
+        {
+            Lcg rng;
+            auto e = arith_tree(params, 10, rng);
+            auto p = params[5];
+            add("d_arith_d10", { { "time", seconds_per_call([&] { e->d(p); }) },
+                                 { "nodes", (double) count_nodes(e->d(p)) } });
+        }
+
+        {
+            // in-place, swapped back and forth so every call sees the same tree
+            Lcg rng;
+            auto e = mixed_tree(params, 10, rng);
+            auto p = params[2];
+            auto q = param("q", 0.5);
+            auto swap = [&] {
+                e->substitute(p, q);
+                e->substitute(q, p);
+            };
+            add("substitute_mixed_d10", { { "time", seconds_per_call(swap) } });
+        }
+        {
+            Lcg rng;
+            auto e = mixed_tree(params, 10, rng);
+            std::unordered_map<ParamPtr, ExprPtr> subs = { { params[2], params[7]->expr() * two },
+                                                           { params[9], zero } };
+            add("substituted_mixed_d10",
+                { { "time", seconds_per_call([&] { e->substituted(subs); }) },
+                  { "nodes", (double) count_nodes(e->substituted(subs)) } });
+        }
+
+        {
+            Lcg rng;
+            auto e = mixed_tree(params, 8, rng);
+            add("to_string_mixed_d8", { { "time", seconds_per_call([&] { e->to_string(); }) },
+                                        { "length", (double) e->to_string().size() } });
+        }
+        std::cerr << "\n";
+        return cases;
+    }
+
+    using Baseline = std::map<std::string, double>;
+
+    Baseline read_baseline(const std::string& path)
+    {
+        Baseline baseline;
+        std::ifstream file(path);
+        if (!file)
+            throw std::runtime_error("cannot read baseline " + path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream is(line);
+            std::string key;
+            double value;
+            if (is >> key >> value)
+                baseline[key] = value;
+        }
+        return baseline;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string baseline_path, write_path;
+    double tolerance = 2.5;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (std::strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc)
+            write_path = argv[++i];
+        else if (std::strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = std::strtod(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--sizes") == 0)
+            timed = false;
+        else
+        {
+            std::cerr << "usage: " << argv[0]
+                      << " [--baseline FILE] [--write-baseline FILE] [--tolerance X] [--sizes]\n";
+            return 2;
+        }
+    }
+    if (!timed && !write_path.empty())
+    {
+        std::cerr << "--write-baseline needs the timings, it can't be used with --sizes\n";
+        return 2;
+    }
+
+    double unit = timed ? reference_unit() : 1.0;
+    auto cases = run_cases();
+
+    // time metrics become multiples of the reference unit
+    for (auto& c : cases)
+    {
+        if (c.metrics.count("time"))
+            c.metrics["time"] /= unit;
+    }
+
+    Baseline baseline;
+    if (!baseline_path.empty())
+        baseline = read_baseline(baseline_path);
+
+    int failures = 0;
+    if (timed)
+        std::cout << "reference unit: " << unit * 1e6 << " us\n";
+    for (const auto& c : cases)
+    {
+        for (const auto& m : c.metrics)
+        {
+            std::string key = c.name + "." + m.first;
+            std::cout << key << " " << m.second;
+            auto it = baseline.find(key);
+            if (it != baseline.end())
+            {
+                double allowed = m.first == "time" ? it->second * tolerance : it->second;
+                bool failed = m.second > allowed;
+                std::cout << " (baseline " << it->second << (failed ? ", REGRESSION)" : ")");
+                if (failed)
+                    failures++;
+            }
+            else if (!baseline_path.empty())
+            {
+                std::cout << " (not in baseline)";
+            }
+            std::cout << "\n";
+        }
+    }
+
+    if (!write_path.empty())
+    {
+        std::ofstream file(write_path);
+        file << "# adjacent_expr_bench baseline: <case>.<metric> <value>\n"
+             << "# time is relative to the reference unit, sizes are exact\n";
+        for (const auto& c : cases)
+        {
+            for (const auto& m : c.metrics)
+                file << c.name << "." << m.first << " " << m.second << "\n";
+        }
+    }
+
+    if (failures > 0)
+    {
+        std::cout << failures << " metric(s) regressed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "constraint.hpp"
+#include "recorder.hpp"
+
+// Re-executes a sketch log written by Sketch::start_recording and reports how long every
+// kind of operation took, the slowest single operations, and updates whose result differs
+// from the recorded one.
+//
+// usage: adjacent_replay LOG [--top N]
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " LOG [--top N]\n";
+        return 1;
+    }
+    std::size_t top = 10;
+    for (int i = 2; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--top" && i + 1 < argc)
+            top = std::stoul(argv[++i]);
+    }
+
+    std::ifstream in(argv[1]);
+    if (!in)
+    {
+        std::cerr << "cannot open " << argv[1] << "\n";
+        return 1;
+    }
+
+    struct Totals
+    {
+        std::size_t count = 0;
+        double seconds = 0.0;
+        double max_seconds = 0.0;
+    };
+    std::map<std::string, Totals> totals;
+    std::vector<ReplayStep> steps;
+    std::size_t mismatches = 0;
+
+    Sketch sketch;
+    try
+    {
+        replay(in, sketch, [&](const ReplayStep& step) {
+            auto& t = totals[step.op];
+            t.count++;
+            t.seconds += step.seconds;
+            t.max_seconds = std::max(t.max_seconds, step.seconds);
+            if (step.result != step.recorded_result)
+                mismatches++;
+            steps.push_back(step);
+        });
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    std::cout << "operation         count    total ms      max ms\n";
+    for (const auto& t : totals)
+    {
+        std::printf("%-14s %8zu %11.3f %11.3f\n", t.first.c_str(), t.second.count,
+                    t.second.seconds * 1e3, t.second.max_seconds * 1e3);
+    }
+
+    std::sort(steps.begin(), steps.end(),
+              [](const ReplayStep& a, const ReplayStep& b) { return a.seconds > b.seconds; });
+    std::cout << "\nslowest operations:\n";
+    for (std::size_t i = 0; i < std::min(top, steps.size()); i++)
+    {
+        std::printf("  line %-8zu %-14s %11.3f ms\n", steps[i].line, steps[i].op.c_str(),
+                    steps[i].seconds * 1e3);
+    }
+
+    if (mismatches > 0)
+        std::cout << "\n" << mismatches << " update(s) returned a different result than recorded\n";
+    return 0;
+}
@@ -1,3 +1,3 @@
 #!/usr/bin/env bash
 
-clang-format -i -style=file src/*.cpp include/*.hpp
+clang-format -i -style=file src/*.cpp include/*.hpp bench/*.cpp
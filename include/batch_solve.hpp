@@ -0,0 +1,22 @@
+#ifndef ADJACENT_BATCH_SOLVE_HPP
+#define ADJACENT_BATCH_SOLVE_HPP
+
+#include <vector>
+
+#include "constraint.hpp"
+#include "thread_pool.hpp"
+
+struct BatchSolveStats
+{
+    SolveResult result = DIDNT_CONVERGE;
+    std::size_t equations = 0;
+    std::size_t unknowns = 0;
+    double seconds = 0.0;
+};
+
+// Updates independent sketches concurrently, sketches must not share params or entities.
+// The largest sketches are scheduled first so a few big ones don't end up last and stall
+// the batch. The calling thread runs queued tasks while it waits.
+std::vector<BatchSolveStats> solve_batch(const std::vector<Sketch*>& sketches, ThreadPool& pool);
+
+#endif
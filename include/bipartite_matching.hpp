@@ -0,0 +1,54 @@
+#ifndef ADJACENT_BIPARTITE_MATCHING_HPP
+#define ADJACENT_BIPARTITE_MATCHING_HPP
+
+#include <vector>
+#include <cstddef>
+
+// Compressed row storage of a sparsity pattern, row r has the non-zero columns
+// cols[row_start[r]] ... cols[row_start[r + 1] - 1]
+struct SparsityPattern
+{
+    std::size_t n_cols = 0;
+    std::vector<std::size_t> row_start = { 0 };
+    std::vector<std::size_t> cols;
+
+    std::size_t rows() const
+    {
+        return row_start.size() - 1;
+    }
+
+    void clear(std::size_t n_cols);
+};
+
+// Hopcroft-Karp maximum matching between the rows and the columns of a pattern.
+// The matching size is the structural rank, an upper bound of the numeric rank.
+class BipartiteMatching
+{
+public:
+    static constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+    std::vector<std::size_t> row_match;
+    std::vector<std::size_t> col_match;
+
+    void compute(const SparsityPattern& pattern);
+
+    std::size_t size() const;
+
+    // rows reachable from unmatched rows by alternating paths: the structurally
+    // over-determined part of the Dulmage-Mendelsohn decomposition
+    std::vector<std::size_t> overdetermined_rows(const SparsityPattern& pattern) const;
+
+private:
+    bool bfs(const SparsityPattern& pattern);
+    bool dfs(const SparsityPattern& pattern, std::size_t root);
+
+    std::size_t m_size = 0;
+    std::size_t m_free_dist = 0;
+    std::vector<std::size_t> m_dist;
+    std::vector<std::size_t> m_next;
+    std::vector<std::size_t> m_queue;
+    std::vector<std::size_t> m_stack;
+    std::vector<std::size_t> m_via;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef ADJACENT_CHOLESKY_HPP
+#define ADJACENT_CHOLESKY_HPP
+
+#include <vector>
+
+#include <xtensor/xtensor.hpp>
+
+// Cholesky factorization L * L^T of a symmetric positive semi-definite matrix such as A * A^T.
+// Pivots that vanish (rows of A that depend on earlier ones) are skipped and the matching
+// unknowns solve to 0, the same way GaussianMethod::solve treats them.
+class Cholesky
+{
+public:
+    // a pivot is skipped if it is <= tolerance * the largest diagonal entry
+    double tolerance = 1e-12;
+
+    void clear();
+    void factorize(const xt::xtensor<double, 2>& M);
+    void solve(const xt::xtensor<double, 1>& b, xt::xtensor<double, 1>& x) const;
+
+    std::size_t size() const;
+    std::size_t skipped() const;
+
+private:
+    std::size_t m_n = 0;
+    std::vector<double> m_l;
+    std::vector<char> m_skip;
+};
+
+// The same factorization stored and computed in single precision, as U^T * U with U row-major
+// so that the updates run over contiguous floats. Only accurate to about 1e-7 relative, meant
+// to be refined against the double matrix (see EquationSystem::mixed_precision).
+class SingleCholesky
+{
+public:
+    // a pivot is skipped if it is <= tolerance * the largest diagonal entry
+    double tolerance = 1e-6;
+
+    void clear();
+    void factorize(const xt::xtensor<double, 2>& M);
+    // solves with the float factor, accumulating in double
+    void solve(const xt::xtensor<double, 1>& b, xt::xtensor<double, 1>& x) const;
+
+    std::size_t size() const;
+
+private:
+    std::size_t m_n = 0;
+    std::vector<float> m_u;
+    std::vector<char> m_skip;
+};
+
+#endif
@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <functional>
+#include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <future>
+#include <iostream>
 
 #include "entity.hpp"
 #include "expression.hpp"
 #include "equation_system.hpp"
+#include "multi_start.hpp"
+#include "recorder.hpp"
+#include "spatial_index.hpp"
 
 #ifndef ADJACENT_CONSTRAINT_HPP
 #define ADJACENT_CONSTRAINT_HPP
@@ -38,7 +48,58 @@ public:
     }
 
     virtual std::vector<ParamPtr> parameters() = 0;
-    virtual std::vector<ExprPtr> equations() = 0;
+
+    // The equations of the current option, built once per option and kept until one of the
+    // entities changes (Entity::changed) or invalidate_equations() is called.
+    const std::vector<ExprPtr>& equations()
+    {
+        return equations_for(option());
+    }
+
+    void invalidate_equations()
+    {
+        m_built.clear();
+    }
+
+protected:
+    // constraints with several forms of their equations (e.g. codirected or antidirected
+    // lines) return which one is in use
+    virtual int option()
+    {
+        return 0;
+    }
+    virtual std::vector<ExprPtr> build_equations(int option) = 0;
+
+    const std::vector<ExprPtr>& equations_for(int option)
+    {
+        bool current = m_revisions.size() == entities.size();
+        for (std::size_t i = 0; current && i < entities.size(); i++)
+            current = m_revisions[i] == entities[i]->revision;
+        if (!current)
+        {
+            m_built.clear();
+            m_revisions.clear();
+            for (auto* e : entities)
+                m_revisions.push_back(e->revision);
+        }
+        if (m_built.size() <= std::size_t(option))
+        {
+            m_built.resize(option + 1, 0);
+            m_equations.resize(option + 1);
+        }
+        if (!m_built[option])
+        {
+            m_equations[option] = build_equations(option);
+            m_built[option] = 1;
+        }
+        return m_equations[option];
+    }
+
+private:
+    std::vector<std::vector<ExprPtr>> m_equations;
+    std::vector<char> m_built;
+    // Entity::revision of the entities when m_equations were built
+    std::vector<std::size_t> m_revisions;
 };
 
 class ValueConstraint : public Constraint
@@ -48,6 +109,11 @@ public:
 
     bool reference = false;
 
+    // set while the constraint belongs to a recording Sketch
+    SketchRecorder* recorder = nullptr;
+    // set while the constraint belongs to a Sketch, which stops its update_async there
+    std::function<void()> before_edit;
+
     ValueConstraint(CONSTRAINT_TYPE type)
         : Constraint(type)
     {
@@ -97,8 +163,14 @@ public:
 
     void set_value(double v)
     {
+        if (before_edit)
+            before_edit();
         // label to value for helix not implemented ...
         value->set_value(v);
+        // AngleConstraint picks the form of its equation by the value
+        invalidate_equations();
+        if (recorder != nullptr)
+            recorder->set_value(this, v);
     }
 };
 
@@ -123,33 +195,37 @@ public:
 
     bool on_satisfy()
     {
-        EquationSystem sys;
-        auto params = parameters();
-        sys.add_parameters(params);
+        // every start value of t is solved in its own system on a private copy of `value`
         auto exprs = equations();
-        sys.add_equations(exprs);
-
-        double bestI = 0.0;
-        double min = -1.0;
-        for (double i = 0.0; i <= 1.0; i += 0.25 / 2.0)
-        {
-            value->set_value(i);
-            sys.solve();
-            double cur_value = 0;
-            for (const auto& e : exprs)
-            {
-                cur_value += abs(e->eval());
-            }
-            if (min >= 0.0 && min < cur_value)
-                continue;
-            bestI = value->value();
-            min = cur_value;
-        }
-        value->set_value(bestI);
+        const int n_starts = 9;
+        std::vector<double> results(n_starts);
+
+        auto result = multi_start(
+            n_starts,
+            [&](std::size_t i, const std::shared_ptr<SolveControl>& control) {
+                auto t = param(value->m_name, i * 0.25 / 2.0);
+                std::unordered_map<ParamPtr, ExprPtr> subs = { { value, t->expr() } };
+
+                EquationSystem sys;
+                sys.control = control;
+                sys.add_parameter(t);
+                for (const auto& e : exprs)
+                    sys.add_equation(e->substituted(subs));
+                sys.solve();
+
+                double residual = 0.0;
+                for (const auto& e : sys.source_equations)
+                    residual = std::max(residual, std::abs(e->eval()));
+                results[i] = t->value();
+                return residual;
+            },
+            &ThreadPool::shared());
+
+        value->set_value(results[result.best]);
         return true;
     }
 
-    std::vector<ExprPtr> equations()
+    std::vector<ExprPtr> build_equations(int) override
     {
         std::vector<ExprPtr> res;
         // var eq = on.PointOnInPlane(value, sketch.plane) - p;
@@ -161,7 +237,7 @@ public:
     }
 };
 
-ExprPtr angle2d(const ExpVector& d0, const ExpVector& d1, bool angle360 = false)
+inline ExprPtr angle2d(const ExpVector& d0, const ExpVector& d1, bool angle360 = false)
 {
     auto nu = d1.x * d0.x + d1.y * d0.y;
     auto nv = d0.x * d1.y - d0.y * d1.x;
@@ -194,7 +270,19 @@ public:
         choose_best_option();
     }
 
-    std::vector<ExprPtr> equations()
+    using Constraint::equations;
+
+    const std::vector<ExprPtr>& equations(Option option)
+    {
+        return equations_for(option);
+    }
+
+    int option() override
+    {
+        return option_;
+    }
+
+    std::vector<ExprPtr> build_equations(int option) override
     {
         // ExpVector d0 = l0.GetPointAtInPlane(0, sketch.plane) - l0.GetPointAtInPlane(1,
         // sketch.plane); ExpVector d1 = l1.GetPointAtInPlane(0, sketch.plane) -
@@ -203,11 +291,8 @@ public:
         ExpVector d1 = *l1->point_on(zero) - *l1->point_on(one);
         // ExprPtr angle = sketch.is3d ? ConstraintExp.angle3d(d0, d1) : ConstraintExp.angle2d(d0,
         // d1);
-        if (!angle)
-        {
-            angle = angle2d(d0, d1);
-        }
-        switch (option_)
+        angle = angle2d(d0, d1);
+        switch ((Option) option)
         {
             case Option::Codirected:
                 return { angle };
@@ -217,26 +302,18 @@ public:
         throw std::runtime_error("unhandled option");
     }
 
+    // the option with the lowest sum of |residual| at the current values
     void choose_best_option()
     {
         double min_value = -1.0;
-        int best_option = 0;
-
         for (int i = 0; i < 2; i++)
         {
-            auto exprs = equations();
             double cur_value = 0.0;
-            for (const auto& el : exprs)
-            {
-                cur_value += abs(el->eval());
-            }
-            std::clog << "check option " << i << " (min: " << min_value << ", cur: " << cur_value
-                      << ")\n";
-
+            for (const auto& el : equations((Option) i))
+                cur_value += std::abs(el->eval());
             if (min_value < 0.0 || cur_value < min_value)
             {
                 min_value = cur_value;
-                best_option = i;
                 option_ = (Option) i;
             }
         }
@@ -262,7 +339,7 @@ public:
         value->set_value(l);
     }
 
-    std::vector<ExprPtr> equations()
+    std::vector<ExprPtr> build_equations(int) override
     {
         return { entity->length() - value->expr() };
     }
@@ -282,7 +359,7 @@ public:
         entities.push_back(p1.get());
     }
 
-    std::vector<ExprPtr> equations()
+    std::vector<ExprPtr> build_equations(int) override
     {
         // var pe0 = p0.GetPointAtInPlane(0, sketch.plane);
         // var pe1 = p1.GetPointAtInPlane(0, sketch.plane);
@@ -331,10 +408,9 @@ public:
         satisfy();
     }
 
-    std::vector<ExprPtr> equations()
+    std::vector<ExprPtr> build_equations(int) override
     {
-        return std::vector<ExprPtr>({ // TODO caching
-                                      (get_point(1) - get_point(0)).magnitude() - value->expr() });
+        return { (get_point(1) - get_point(0)).magnitude() - value->expr() };
     }
 
     ExpVector get_point(double i)
@@ -386,7 +462,7 @@ public:
         entities.push_back(line.get());
     }
 
-    std::vector<ExprPtr> equations()
+    std::vector<ExprPtr> build_equations(int) override
     {
         ExprPtr exp;
         switch (orientation)
@@ -432,7 +508,7 @@ public:
         value->set_value(angle);
     }
 
-    std::vector<ExprPtr> equations()
+    std::vector<ExprPtr> build_equations(int) override
     {
         std::array<ExpVector, 4> pts;
         if (std::abs(value->value()) > M_PI_2)
@@ -509,7 +585,7 @@ public:
         value->set_value(diameter);
     }
 
-    std::vector<ExprPtr> equations()
+    std::vector<ExprPtr> build_equations(int) override
     {
         return { e->radius() * two - value->expr() };
     }
@@ -526,26 +602,18 @@ public:
 
     Option _option = Option::Codirected;
 
+    // the option with the lowest sum of |residual| at the current values
     void choose_best_option()
     {
         double min_value = -1.0;
-        int best_option = 0;
-
         for (int i = 0; i < 2; i++)
         {
-            auto exprs = equations();
             double cur_value = 0.0;
-            for (const auto& el : exprs)
-            {
-                cur_value += abs(el->eval());
-            }
-            std::clog << "check option " << i << " (min: " << min_value << ", cur: " << cur_value
-                      << ")\n";
-
+            for (const auto& el : equations((Option) i))
+                cur_value += std::abs(el->eval());
             if (min_value < 0.0 || cur_value < min_value)
             {
                 min_value = cur_value;
-                best_option = i;
                 _option = (Option) i;
             }
         }
@@ -574,8 +642,10 @@ public:
         auto* s0 = dynamic_cast<SegmentaryEntity*>(l0);
         auto* s1 = dynamic_cast<SegmentaryEntity*>(l1);
 
-        // For the is_coincident_with_curve query we need to have access to all constraints to query
-        // wether there is a coincident with ... constraint already
+        // Never finds a coincidence, so a tangent always solves for t0 and t1. Sketch answers
+        // these queries (is_coincident_with, point_on_curve), but a constraint has no link to
+        // its sketch, and its equations would then also have to be rebuilt whenever a PointOn
+        // or PointsCoincident constraint on its entities is added or removed.
 
         // if(s0 != nullptr && s1 != nullptr) {
         //    if (s0->begin->IsCoincidentWith(s1.begin))   { tv0 = 0.0; tv1 = 0.0; return true; }
@@ -632,7 +702,19 @@ public:
         return {};
     }
 
-    std::vector<ExprPtr> equations()
+    using Constraint::equations;
+
+    const std::vector<ExprPtr>& equations(Option option)
+    {
+        return equations_for(option);
+    }
+
+    int option() override
+    {
+        return _option;
+    }
+
+    std::vector<ExprPtr> build_equations(int option) override
     {
         // select point on circle (t0) and on line (t1),
         // force them to overlap and have equal tangent angle
@@ -655,7 +737,7 @@ public:
             // Exp angle = sketch.is3d ? ConstraintExp.angle3d(dir0, dir1) :
             // ConstraintExp.angle2d(dir0, dir1);
             auto angle = angle2d(*dir0, *dir1);
-            switch (_option)
+            switch ((Option) option)
             {
                 case Option::Codirected:
                     res.push_back(angle);
@@ -705,12 +787,93 @@ public:
 
     std::set<EntityPtr> entities;
     std::set<ConstraintPtr> constraints;
+    // entities and constraints in the order they were added, by a key that only grows.
+    // generate_equations follows it, so an edit appends params and equations after the ones
+    // already there and the rank test keeps their rows.
+    struct Generated
+    {
+        EntityPtr entity;
+        ConstraintPtr constraint;
+    };
+    std::map<std::size_t, Generated> generation_order;
+    std::unordered_map<const void*, std::size_t> generation_keys;
+    std::size_t next_generation_key = 0;
+    // the entities by position, kept current through solves and drags
+    SpatialIndex spatial_index;
+
+    // what is attached to an entity of the sketch or of one of its constraints
+    struct EntityLinks
+    {
+        bool in_sketch = false;
+        std::vector<ConstraintPtr> constraints;
+        // the params of the entity when it was linked, an entity whose params are replaced has
+        // to be removed and added again
+        std::vector<ParamPtr> params;
+    };
+    // Adjacency between entities, constraints and params, kept by add/remove_entity and
+    // add/remove_constraint so that what is connected to an entity is found in O(degree).
+    // The same point can be several entities sharing params (a PointE and the end of a
+    // LineE), param_entities connects them.
+    std::unordered_map<Entity*, EntityLinks> entity_links;
+    std::unordered_map<const Param<double>*, std::vector<Entity*>> param_entities;
+
+    // in-flight update_async, if any
+    std::shared_ptr<SolveControl> pending_control;
+    std::shared_future<SolveResult> pending_update;
+
+    std::shared_ptr<SketchRecorder> recorder;
+
+    // interactive drag in progress, see begin_drag
+    std::shared_ptr<PointE> dragged;
+    ParamPtr drag_x, drag_y;
+    std::unique_ptr<EquationSystem> drag_sys;
+    // the entities whose boxes in spatial_index a drag frame can move
+    std::vector<Entity*> drag_entities;
+
+    ~Sketch()
+    {
+        end_drag();
+        cancel_update();
+        stop_recording();
+        for (const auto& c : constraints)
+        {
+            if (auto* vc = dynamic_cast<ValueConstraint*>(c.get()))
+                vc->before_edit = nullptr;
+        }
+    }
 
     void add_entity(const EntityPtr& e)
     {
         if (entities.find(e) != entities.end())
             return;
+        end_drag();
+        cancel_update();
         entities.insert(e);
+        add_generated(e.get(), { e, nullptr });
+        link_entity(e.get()).in_sketch = true;
+        spatial_index.insert(e.get());
+        mark_dirty(/*topo*/ true, /*constraints*/ false, /*entities*/ true, /*loops*/ false);
+        if (recorder != nullptr)
+            recorder->add_entity(e.get());
+    }
+
+    // removes `e` and the constraints on it
+    void remove_entity(const EntityPtr& e)
+    {
+        if (entities.find(e) == entities.end())
+            return;
+        end_drag();
+        cancel_update();
+        std::vector<ConstraintPtr> attached = constraints_of(e.get());
+        for (const auto& c : attached)
+            remove_constraint(c);
+        if (recorder != nullptr)
+            recorder->remove_entity(e.get());
+        entity_links[e.get()].in_sketch = false;
+        unlink_entity(e.get());
+        spatial_index.remove(e.get());
+        entities.erase(e);
+        remove_generated(e.get());
         mark_dirty(/*topo*/ true, /*constraints*/ false, /*entities*/ true, /*loops*/ false);
     }
 
@@ -727,12 +890,390 @@ public:
     {
         if (constraints.find(c) != constraints.end())
             return;
+        end_drag();
+        cancel_update();
         constraints.insert(c);
+        add_generated(c.get(), { nullptr, c });
+        for (auto* e : c->entities)
+            link_entity(e).constraints.push_back(c);
+        if (auto* vc = dynamic_cast<ValueConstraint*>(c.get()))
+            vc->before_edit = [this] { cancel_update(); };
         mark_dirty(/*topo*/ c->type == PointsCoincident,
                    /*constraints*/ true,
                    /*entities*/ false,
                    /*loops*/ false);
         constraintsTopologyChanged = true;
+        if (recorder != nullptr)
+            record_constraint(c.get());
+    }
+
+    void remove_constraint(const ConstraintPtr& c)
+    {
+        if (constraints.find(c) == constraints.end())
+            return;
+        end_drag();
+        cancel_update();
+        if (recorder != nullptr)
+            recorder->remove_constraint(c.get());
+        for (auto* e : c->entities)
+        {
+            auto& attached = entity_links[e].constraints;
+            auto it = std::find(attached.begin(), attached.end(), c);
+            if (it != attached.end())
+                attached.erase(it);
+            unlink_entity(e);
+        }
+        if (auto* vc = dynamic_cast<ValueConstraint*>(c.get()))
+        {
+            vc->recorder = nullptr;
+            vc->before_edit = nullptr;
+        }
+        constraints.erase(c);
+        remove_generated(c.get());
+        mark_dirty(/*topo*/ true, /*constraints*/ true, /*entities*/ false, /*loops*/ false);
+    }
+
+    void add_generated(const void* key, Generated item)
+    {
+        generation_keys[key] = next_generation_key;
+        generation_order.emplace(next_generation_key++, std::move(item));
+    }
+
+    void remove_generated(const void* key)
+    {
+        auto it = generation_keys.find(key);
+        generation_order.erase(it->second);
+        generation_keys.erase(it);
+    }
+
+    // entities with one of `params` into `out`, each once
+    void entities_of(const std::vector<ParamPtr>& params, std::vector<Entity*>& out) const
+    {
+        out.clear();
+        std::unordered_set<Entity*> seen;
+        for (const auto& prm : params)
+        {
+            auto it = param_entities.find(prm.get());
+            if (it == param_entities.end())
+                continue;
+            for (auto* e : it->second)
+            {
+                if (seen.insert(e).second)
+                    out.push_back(e);
+            }
+        }
+    }
+
+    // constraints with `e` among their entities
+    const std::vector<ConstraintPtr>& constraints_of(Entity* e) const
+    {
+        static const std::vector<ConstraintPtr> none;
+        auto it = entity_links.find(e);
+        return it == entity_links.end() ? none : it->second.constraints;
+    }
+
+    // constraints of `e` and of the entities sharing a param with it, e.g. the ones on the end
+    // points of a line, which are the constraints a drag of `e` moves first
+    std::vector<ConstraintPtr> constraints_touching(Entity* e) const
+    {
+        std::vector<ConstraintPtr> res;
+        std::unordered_set<Constraint*> seen;
+        std::unordered_set<Entity*> visited;
+        for (const auto& prm : e->parameters())
+        {
+            auto it = param_entities.find(prm.get());
+            if (it == param_entities.end())
+                continue;
+            for (auto* other : it->second)
+            {
+                if (!visited.insert(other).second)
+                    continue;
+                for (const auto& c : constraints_of(other))
+                {
+                    if (seen.insert(c.get()).second)
+                        res.push_back(c);
+                }
+            }
+        }
+        return res;
+    }
+
+    // the points at the same place as `p` because they share its params or through
+    // PointsCoincident constraints, `p` itself excluded. The ends of lines and centers of
+    // circles count as points.
+    std::vector<PointE*> coincident_points(PointE* p) const
+    {
+        std::vector<PointE*> res;
+        std::unordered_set<PointE*> found = { p };
+        std::unordered_set<const Param<double>*> visited = { p->x.get() };
+        std::vector<PointE*> stack = { p };
+        std::vector<PointE*> same;
+        while (!stack.empty())
+        {
+            PointE* q = stack.back();
+            stack.pop_back();
+            points_at(q->x.get(), same);
+            for (auto* r : same)
+            {
+                if (found.insert(r).second)
+                    res.push_back(r);
+                for (const auto& c : constraints_of(r))
+                {
+                    if (c->type != PointsCoincident)
+                        continue;
+                    auto* pc = static_cast<PointsCoincidentConstraint*>(c.get());
+                    PointE* other = pc->p0.get() == r ? pc->p1.get() : pc->p0.get();
+                    if (visited.insert(other->x.get()).second)
+                        stack.push_back(other);
+                }
+            }
+        }
+        return res;
+    }
+
+    bool is_coincident_with(PointE* p, PointE* q) const
+    {
+        if (p == q || p->x == q->x)
+            return true;
+        auto points = coincident_points(p);
+        return std::find(points.begin(), points.end(), q) != points.end();
+    }
+
+    // the PointOn constraint putting `p`, or a point coincident with it, on `curve`
+    PointOnConstraint* point_on_curve(PointE* p, Entity* curve) const
+    {
+        auto points = coincident_points(p);
+        points.push_back(p);
+        for (auto* q : points)
+        {
+            for (const auto& c : constraints_of(q))
+            {
+                auto* on = dynamic_cast<PointOnConstraint*>(c.get());
+                if (on != nullptr && on->point.get() == q && on->on.get() == curve)
+                    return on;
+            }
+        }
+        return nullptr;
+    }
+
+    EntityLinks& link_entity(Entity* e)
+    {
+        auto inserted = entity_links.emplace(e, EntityLinks());
+        EntityLinks& links = inserted.first->second;
+        if (inserted.second)
+        {
+            links.params = e->parameters();
+            for (const auto& prm : links.params)
+                param_entities[prm.get()].push_back(e);
+        }
+        return links;
+    }
+
+    // forgets `e` once neither the sketch nor a constraint refers to it
+    void unlink_entity(Entity* e)
+    {
+        auto it = entity_links.find(e);
+        if (it == entity_links.end() || it->second.in_sketch || !it->second.constraints.empty())
+            return;
+        for (const auto& prm : it->second.params)
+        {
+            auto& users = param_entities[prm.get()];
+            auto user = std::find(users.begin(), users.end(), e);
+            if (user != users.end())
+            {
+                *user = users.back();
+                users.pop_back();
+            }
+            if (users.empty())
+                param_entities.erase(prm.get());
+        }
+        entity_links.erase(it);
+    }
+
+    // the PointE entities with `x` as their x param, and the ends of lines and centers of
+    // circles at it
+    void points_at(const Param<double>* x, std::vector<PointE*>& out) const
+    {
+        out.clear();
+        auto it = param_entities.find(x);
+        if (it == param_entities.end())
+            return;
+        for (auto* e : it->second)
+        {
+            if (auto* p = dynamic_cast<PointE*>(e))
+                out.push_back(p);
+            else if (auto* l = dynamic_cast<LineE*>(e))
+            {
+                if (l->p0.x.get() == x)
+                    out.push_back(&l->p0);
+                if (l->p1.x.get() == x)
+                    out.push_back(&l->p1);
+            }
+            else if (auto* c = dynamic_cast<CircleE*>(e))
+            {
+                if (c->center().x.get() == x)
+                    out.push_back(&c->center());
+            }
+        }
+    }
+
+    // Starts dragging `p`. The constraints connected to it and the drag equations are put
+    // into a system of their own once, which every update_drag re-solves from the previous
+    // frame while keeping the factorization of its Jacobian.
+    void begin_drag(const std::shared_ptr<PointE>& p)
+    {
+        end_drag();
+        cancel_update();
+
+        // the params connected to p by constraints, searched through the adjacency index so
+        // only the part of the sketch around p is visited. Params of entities that are not in
+        // the sketch stay fixed, as in update().
+        auto solved = [this, &p](const ParamPtr& prm) {
+            if (prm == p->x || prm == p->y)
+                return true;
+            auto it = param_entities.find(prm.get());
+            if (it == param_entities.end())
+                return false;
+            for (auto* e : it->second)
+            {
+                if (entity_links.at(e).in_sketch)
+                    return true;
+            }
+            return false;
+        };
+        std::vector<ParamPtr> params;
+        std::unordered_set<const Param<double>*> reached;
+        auto reach = [&params, &reached](const ParamPtr& prm) {
+            if (reached.insert(prm.get()).second)
+                params.push_back(prm);
+        };
+        // the drag equations tie x and y together
+        for (const auto& prm : p->parameters())
+            reach(prm);
+        std::vector<ConstraintPtr> connected;
+        std::unordered_set<Constraint*> visited;
+        for (std::size_t i = 0; i < params.size(); i++)
+        {
+            auto it = param_entities.find(params[i].get());
+            if (it == param_entities.end())
+                continue;
+            for (auto* e : it->second)
+            {
+                for (const auto& c : entity_links.at(e).constraints)
+                {
+                    if (!visited.insert(c.get()).second)
+                        continue;
+                    connected.push_back(c);
+                    for (const auto& prm : c->parameters())
+                        reach(prm);
+                    for (auto* ce : c->entities)
+                    {
+                        for (const auto& prm : ce->parameters())
+                        {
+                            if (solved(prm))
+                                reach(prm);
+                        }
+                    }
+                }
+            }
+        }
+
+        drag_sys = std::make_unique<EquationSystem>();
+        drag_sys->keep_factorization = true;
+        drag_sys->warm_start_capacity = 0;
+        // the kept factorization is reused over many frames, so it stays ahead of LSQR up to
+        // larger systems than a single solve does
+        drag_sys->lsqr_threshold = 2 * sys.lsqr_threshold;
+        drag_sys->add_parameters(params);
+        for (const auto& c : connected)
+            drag_sys->add_equations(c->equations());
+
+        dragged = p;
+        drag_x = param("drag_x", p->x->value());
+        drag_y = param("drag_y", p->y->value());
+        drag_sys->add_equation(p->x->expr()->drag(drag_x->expr()));
+        drag_sys->add_equation(p->y->expr()->drag(drag_y->expr()));
+        drag_sys->update_dirty();
+        entities_of(params, drag_entities);
+
+        if (recorder != nullptr)
+            recorder->begin_drag(p.get());
+    }
+
+    // moves the dragged point towards (x, y) and solves the connected constraints
+    SolveResult update_drag(double x, double y)
+    {
+        if (drag_sys == nullptr)
+            throw std::runtime_error("update_drag without begin_drag");
+        cancel_update();
+        drag_x->set_value(x);
+        drag_y->set_value(y);
+        auto res = drag_sys->solve();
+        for (auto* e : drag_entities)
+            spatial_index.moved(e);
+        if (recorder != nullptr)
+            recorder->update_drag(dragged.get(), x, y, res);
+        return res;
+    }
+
+    void end_drag()
+    {
+        if (drag_sys == nullptr)
+            return;
+        cancel_update();
+        if (recorder != nullptr)
+            recorder->end_drag(dragged.get());
+        drag_sys = nullptr;
+        dragged = nullptr;
+        drag_x = drag_y = nullptr;
+        drag_entities.clear();
+        mark_dirty(/*topo*/ false, /*constraints*/ false, /*entities*/ true, /*loops*/ false);
+    }
+
+    // moves a point to where the user dragged it
+    void drag_point(const std::shared_ptr<PointE>& p, double x, double y)
+    {
+        cancel_update();
+        p->x->set_value(x);
+        p->y->set_value(y);
+        std::vector<Entity*> moved;
+        entities_of({ p->x, p->y }, moved);
+        spatial_index.moved(p.get());
+        for (auto* e : moved)
+            spatial_index.moved(e);
+        mark_dirty(/*topo*/ false, /*constraints*/ false, /*entities*/ true, /*loops*/ false);
+        if (recorder != nullptr)
+            recorder->drag(p.get(), x, y);
+    }
+
+    // logs every following edit to `out`, starting with the current contents of the sketch
+    void start_recording(std::ostream& out)
+    {
+        cancel_update();
+        stop_recording();
+        recorder = std::make_shared<SketchRecorder>(out);
+        for (const auto& e : entities)
+            recorder->add_entity(e.get());
+        for (const auto& c : constraints)
+            record_constraint(c.get());
+    }
+
+    void stop_recording()
+    {
+        cancel_update();
+        for (const auto& c : constraints)
+        {
+            if (auto* vc = dynamic_cast<ValueConstraint*>(c.get()))
+                vc->recorder = nullptr;
+        }
+        recorder = nullptr;
+    }
+
+    void record_constraint(Constraint* c)
+    {
+        if (auto* vc = dynamic_cast<ValueConstraint*>(c))
+            vc->recorder = recorder.get();
+        recorder->add_constraint(c);
     }
 
     bool is_dirty() const
@@ -755,7 +1296,65 @@ public:
         return topologyChanged;
     }
 
-    void update()
+    SolveResult update()
+    {
+        cancel_update();
+        auto res = run_update();
+        spatial_index.invalidate();
+        return res;
+    }
+
+    // Runs update() on the solver's thread pool. The solve stops at the deadline or on
+    // cancel_update(), leaving the best iterate found so far and returning CANCELLED.
+    //
+    // Until the future is ready the params belong to the solve: the Sketch's own mutators
+    // and ValueConstraint::set_value cancel it first, but param values must not be read or
+    // written directly, call cancel_update() or wait for the future before doing so.
+    std::shared_future<SolveResult> update_async(std::chrono::steady_clock::time_point deadline
+                                                 = std::chrono::steady_clock::time_point::max())
+    {
+        cancel_update();
+        pending_control = std::make_shared<SolveControl>();
+        pending_control->deadline = deadline;
+        sys.control = pending_control;
+        // from here on the index refreshes on the first query, which has to wait for the
+        // future like any other read of the values
+        spatial_index.invalidate();
+
+        auto promise = std::make_shared<std::promise<SolveResult>>();
+        pending_update = promise->get_future().share();
+        ThreadPool& pool = sys.thread_pool ? *sys.thread_pool : ThreadPool::shared();
+        pool.submit([this, promise]() {
+            SolveResult res = CANCELLED;
+            try
+            {
+                res = run_update();
+            }
+            catch (...)
+            {
+                sys.control = nullptr;
+                promise->set_exception(std::current_exception());
+                return;
+            }
+            sys.control = nullptr;
+            promise->set_value(res);
+        });
+        return pending_update;
+    }
+
+    // Cancels the in-flight update_async, if any, and waits for it to stop
+    void cancel_update()
+    {
+        if (!pending_update.valid())
+            return;
+        pending_control->cancel();
+        pending_update.wait();
+        pending_update = std::shared_future<SolveResult>();
+        pending_control = nullptr;
+    }
+
+private:
+    SolveResult run_update()
     {
         if (is_constraints_changed() || is_entities_changed())
         {
@@ -767,21 +1366,27 @@ public:
             generate_equations(sys);
         }
         auto res = (!supressSolve || sys.has_dragged()) ? sys.solve() : DIDNT_CONVERGE;
-        if (res == DIDNT_CONVERGE)
+        if (res == DIDNT_CONVERGE || res == REDUNDANT)
         {
             supressSolve = true;
         }
+        if (recorder != nullptr)
+            recorder->update(res);
+        return res;
     }
 
+public:
+    // params and equations in the order their entities and constraints were added
     void generate_equations(EquationSystem& system)
     {
-        for (const auto& en : entities)
-        {
-            system.add_parameters(en->parameters());
-            // system.add_equations(en->equations());
-        }
-        for (const auto& c : constraints)
+        for (const auto& item : generation_order)
         {
+            if (const auto& en = item.second.entity)
+            {
+                system.add_parameters(en->parameters());
+                continue;
+            }
+            const auto& c = item.second.constraint;
             system.add_parameters(c->parameters());
             system.add_equations(c->equations());
         }
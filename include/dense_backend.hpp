@@ -0,0 +1,93 @@
+#ifndef ADJACENT_DENSE_BACKEND_HPP
+#define ADJACENT_DENSE_BACKEND_HPP
+
+#include <memory>
+#include <vector>
+
+#include <xtensor/xtensor.hpp>
+
+#include "rank_revealing_qr.hpp"
+
+// Dense linear algebra used by EquationSystem on the full Jacobian: forming the normal matrix,
+// solving it, and the numeric rank. Every system owns its backend, so implementations can keep
+// state and workspace between calls.
+class DenseBackend
+{
+public:
+    virtual ~DenseBackend() = default;
+
+    virtual const char* name() const = 0;
+
+    // M = Dr A Dc^2 A^T Dr with Dr = diag(row_scale), Dc = diag(col_scale), M is rows x rows
+    virtual void normal_matrix(const xt::xtensor<double, 2>& A,
+                               const std::vector<double>& row_scale,
+                               const std::vector<double>& col_scale,
+                               xt::xtensor<double, 2>& M) = 0;
+    // M X = B for the symmetric positive semi-definite M, overwriting M & B. Unknowns of
+    // dependent rows solve to 0 as in GaussianMethod::solve.
+    virtual void solve_normal(xt::xtensor<double, 2>& M, xt::xtensor<double, 1>& B,
+                              xt::xtensor<double, 1>& X) = 0;
+    // numeric rank of A, with the rows that depend on the others in dependent_rows(). The
+    // first kept_rows rows of A are the first rows of the previous call (same equations, and
+    // the same params at the same values in the first columns; columns can have been
+    // appended), a backend may keep what it computed for them.
+    virtual std::size_t rank(const xt::xtensor<double, 2>& A, std::size_t kept_rows) = 0;
+    virtual const std::vector<std::size_t>& dependent_rows() const = 0;
+};
+
+// The built-in loops: a blocked product for the normal matrix, GaussianMethod and
+// RankRevealingQR. When all the rows of the last rank() are kept, only the rows appended
+// since are orthogonalized against the existing basis.
+class ReferenceBackend : public DenseBackend
+{
+public:
+    const char* name() const override;
+
+    void normal_matrix(const xt::xtensor<double, 2>& A, const std::vector<double>& row_scale,
+                       const std::vector<double>& col_scale, xt::xtensor<double, 2>& M) override;
+    void solve_normal(xt::xtensor<double, 2>& M, xt::xtensor<double, 1>& B,
+                      xt::xtensor<double, 1>& X) override;
+    std::size_t rank(const xt::xtensor<double, 2>& A, std::size_t kept_rows) override;
+    const std::vector<std::size_t>& dependent_rows() const override;
+
+private:
+    // Dr A Dc, and the non-zeros of its row r are in columns [m_first[r], m_last[r])
+    std::vector<double> m_scaled;
+    std::vector<std::size_t> m_first;
+    std::vector<std::size_t> m_last;
+    RankRevealingQR m_qr;
+};
+
+#ifdef ADJACENT_USE_LAPACK
+// dsyrk for the normal matrix, dpotrf/dpotrs to solve it (falling back to GaussianMethod when
+// it is singular) and dgeqp3 on A^T for the rank. Built with the ADJACENT_USE_LAPACK option.
+class LapackBackend : public DenseBackend
+{
+public:
+    // a row is dependent if its diagonal entry of R is <= tolerance * max(1, |row|)
+    double tolerance = 1e-4;
+
+    const char* name() const override;
+
+    void normal_matrix(const xt::xtensor<double, 2>& A, const std::vector<double>& row_scale,
+                       const std::vector<double>& col_scale, xt::xtensor<double, 2>& M) override;
+    void solve_normal(xt::xtensor<double, 2>& M, xt::xtensor<double, 1>& B,
+                      xt::xtensor<double, 1>& X) override;
+    std::size_t rank(const xt::xtensor<double, 2>& A, std::size_t kept_rows) override;
+    const std::vector<std::size_t>& dependent_rows() const override;
+
+private:
+    std::vector<double> m_scaled;
+    std::vector<double> m_factor;
+    std::vector<double> m_tau;
+    std::vector<double> m_work;
+    std::vector<double> m_norms;
+    std::vector<int> m_pivots;
+    std::vector<std::size_t> m_dependent;
+};
+#endif
+
+// LapackBackend when it is built, ReferenceBackend otherwise
+std::unique_ptr<DenseBackend> make_dense_backend();
+
+#endif
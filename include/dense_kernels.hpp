@@ -0,0 +1,26 @@
+#ifndef ADJACENT_DENSE_KERNELS_HPP
+#define ADJACENT_DENSE_KERNELS_HPP
+
+#include <cstddef>
+#include <string>
+
+// Inner loops of the built-in dense linear algebra (GaussianMethod, ReferenceBackend). There is
+// a scalar version and, on x86-64 with GCC or Clang, AVX2 and AVX-512 ones, the best the CPU
+// supports is picked the first time dense_kernels() is called.
+struct DenseKernels
+{
+    const char* isa;
+    // y[i] -= sum over k < count of coefs[k] * rows[k][i] for i < n, k in increasing order
+    void (*update_row)(std::size_t n, std::size_t count, const double* coefs,
+                       const double* const* rows, double* y);
+    double (*dot)(std::size_t n, const double* x, const double* y);
+    // out[j] += x . y[j] for the four rows y[0..3]
+    void (*dot4)(std::size_t n, const double* x, const double* const* y, double* out);
+};
+
+const DenseKernels& dense_kernels();
+// the kernels of one instruction set ("scalar", "avx2", "avx512"), nullptr if the CPU or
+// the build doesn't support it
+const DenseKernels* find_dense_kernels(const std::string& isa);
+
+#endif
@@ -11,6 +11,15 @@ using ExpVectorPtr = std::shared_ptr<ExpVector>;
 class Entity
 {
 public:
+    // bumped by changed(), constraints rebuild their equations when it moves
+    std::size_t revision = 0;
+
+    // to be called after replacing any of the params of the entity
+    virtual void changed()
+    {
+        revision++;
+    }
+
     // virtual std::shared_ptr<ExpVector> get_points() = 0;
     // virtual std::shared_ptr<ExpVector> get_segments() = 0;
     virtual std::string to_string() = 0;
@@ -40,6 +49,12 @@ public:
 
     // PointE& PointE(const PointE&) = default;
 
+    void changed()
+    {
+        exp_ = nullptr;
+        Entity::changed();
+    }
+
     std::string to_string()
     {
         return "Point(" + x->to_string() + ", " + y->to_string() + ", " + z->to_string() + ")";
@@ -117,6 +132,12 @@ public:
     {
     }
 
+    void changed()
+    {
+        _center.changed();
+        Entity::changed();
+    }
+
     std::vector<ParamPtr> parameters()
     {
         std::vector<ParamPtr> res = _center.parameters();
@@ -191,6 +212,13 @@ public:
         return p0.is_changed() || p1.is_changed();
     }
 
+    void changed()
+    {
+        p0.changed();
+        p1.changed();
+        Entity::changed();
+    }
+
     PointE& source()
     {
         return p0;
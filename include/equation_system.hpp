@@ -2,23 +2,82 @@
 #define ADJACENT_EQUATION_SYSTEM_HPP
 
 #include <vector>
+#include <list>
+#include <atomic>
+#include <chrono>
+#include <string>
 #include <unordered_map>
 
 #include <xtensor/xtensor.hpp>
 #include "expression.hpp"
 #include "expression_vector.hpp"
 #include "gaussian_method.hpp"
+#include "dense_backend.hpp"
+#include "param_store.hpp"
+#include "cholesky.hpp"
+#include "bipartite_matching.hpp"
+#include "thread_pool.hpp"
+#include "solve_report.hpp"
 
 enum SolveResult
 {
     OKAY,
     DIDNT_CONVERGE,
     REDUNDANT,
-    POSTPONE
+    POSTPONE,
+    CANCELLED
 };
 
 using expr_ptr = std::shared_ptr<Expr>;
 
+// How the least squares step of a Newton iteration is computed
+enum LinearSolver
+{
+    // forms and eliminates A * A^T, needs the dense J and A
+    LINEAR_DENSE,
+    // matrix-free LSQR on the sparse Jacobian, only needs products with A and A^T
+    LINEAR_LSQR,
+    // LINEAR_LSQR once the system has lsqr_threshold unknowns or more
+    LINEAR_AUTO
+};
+
+// Factorization of A * A^T at some earlier iterate, reused for chord (simplified Newton) steps
+struct KeptFactorization
+{
+    bool valid = false;
+    xt::xtensor<double, 2> A;
+    Cholesky normal;
+    // squared residual norm of the previous step taken with it, < 0 if none yet in this solve
+    double residual = -1.0;
+};
+
+// Lets another thread stop a running solve, checked between iterations
+struct SolveControl
+{
+    std::atomic<bool> cancelled{ false };
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    void cancel()
+    {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool should_stop() const
+    {
+        return cancelled.load(std::memory_order_relaxed)
+               || std::chrono::steady_clock::now() >= deadline;
+    }
+};
+
+// Converged parameter values of a previously solved configuration
+struct WarmStartEntry
+{
+    std::size_t key;
+    std::size_t structure_hash;
+    std::vector<double> inputs;
+    std::vector<double> values;
+};
+
 class EquationSystem
 {
 public:
@@ -27,8 +86,69 @@ public:
     int drag_steps = 3;
     bool revert_when_not_converged = true;
 
-    std::string stats;
+    // backtracking line search on |f|^2: a step is halved up to max_backtracks times until
+    // |f|^2 drops below the largest of the last line_search_memory values by at least
+    // `armijo` times what the linearization predicts. With it a solve also gives up after
+    // divergence_steps steps in a row that didn't take |f|^2 below divergence_ratio times
+    // the smallest value so far.
+    bool line_search = true;
+    double armijo = 1e-4;
+    int max_backtracks = 6;
+    int line_search_memory = 5;
+    int divergence_steps = 6;
+    double divergence_ratio = 0.98;
+
+    // number of configurations kept for warm starting, 0 disables the cache
+    std::size_t warm_start_capacity = 16;
+
+    // residuals and the Jacobian are evaluated on the pool once J has at least
+    // parallel_threshold non-zeros, smaller systems stay on the calling thread
+    std::shared_ptr<ThreadPool> thread_pool;
+    std::size_t parallel_threshold = 20000;
+    std::size_t parallel_grain = 64;
+
+    // scale the rows and columns of J by powers of two before the least squares step, and
+    // test each residual relative to how much its equation moves with the params
+    bool equilibrate = true;
+
+    // normal matrix, its solve and the rank test of the dense path, can be replaced by another
+    // DenseBackend before solving
+    std::unique_ptr<DenseBackend> dense_backend = make_dense_backend();
+
+    // the dense path factors A * A^T in single precision and refines the step in double,
+    // falling back to the double elimination if mixed_precision_refinements refinement steps
+    // don't bring the relative residual below mixed_precision_tolerance
+    bool mixed_precision = false;
+    double mixed_precision_tolerance = 1e-12;
+    int mixed_precision_refinements = 5;
+
+    LinearSolver linear_solver = LINEAR_AUTO;
+    std::size_t lsqr_threshold = 500;
+    // LSQR stops when the (row scaled) residual or normal equation residual is relatively
+    // below lsqr_tolerance, or after lsqr_max_iterations (0 picks 2 * min(rows, cols) + 10)
+    double lsqr_tolerance = 1e-10;
+    std::size_t lsqr_max_iterations = 0;
+
+    // for interactive dragging: solve() keeps the factorization of the Jacobian between
+    // iterations and calls and only refactors when a step reduces the residual by less than
+    // kept_contraction. kept[1] includes the drag rows, kept[0] doesn't. A failed solve
+    // returns DIDNT_CONVERGE without testing for REDUNDANT equations.
+    bool keep_factorization = false;
+    double kept_contraction = 0.25;
+    KeptFactorization kept[2];
+
+    // when set, solve() stops between iterations once it asks to and returns CANCELLED
+    // with the params at the best iterate found so far
+    std::shared_ptr<SolveControl> control;
+
+    // called with `report` after every solve; when unset nothing is timed or recorded
+    SolveReportSink report_sink;
+    SolveReport report;
+
     bool dof_changed;
+    // set by test_rank when the dof it returned is only a lower bound: for sparse systems only
+    // the structural rank is known, and the numeric rank can be below it
+    bool dof_is_lower_bound = false;
 
     xt::xtensor<std::shared_ptr<Expr>, 2> J;
     xt::xtensor<double, 2> A;
@@ -36,15 +156,72 @@ public:
     xt::xtensor<double, 1> B;
     xt::xtensor<double, 1> X;
     xt::xtensor<double, 1> Z;
+    // B with the rows scaled for solve_least_squares
+    xt::xtensor<double, 1> scaled_B;
+    SingleCholesky single_normal;
+    xt::xtensor<double, 1> refine_residual;
+    xt::xtensor<double, 1> refine_correction;
+    // residual at and params before a trial step of the line search
+    xt::xtensor<double, 1> trial_B;
+    xt::xtensor<double, 1> step_origin;
+    std::vector<double> residual_history;
     xt::xtensor<double, 1> old_param_value;
+    xt::xtensor<double, 1> best_param_value;
+
+    // non-zero structure of J and the maximum matching between equations and unknowns
+    SparsityPattern jacobian_pattern;
+    // jacobian_pattern by columns, the rows of column c are
+    // pattern_col_rows[pattern_col_start[c] .. pattern_col_start[c + 1])
+    std::vector<std::size_t> pattern_col_start;
+    std::vector<std::size_t> pattern_col_rows;
+    // with LSQR only the non-zeros of J (in jacobian_pattern order) and their values are kept,
+    // J, A and AAT stay empty
+    bool sparse = false;
+    std::vector<std::shared_ptr<Expr>> sparse_jacobian;
+    std::vector<double> sparse_values;
+    std::vector<double> row_scale, col_scale, lsqr_u, lsqr_v, lsqr_w;
+    BipartiteMatching structural_matching;
+    // sum of |df/dp| * |p| over the unknowns of each of `equations` at the last Jacobian
+    // evaluation, for residual_tolerance
+    std::vector<double> residual_scale;
+    std::vector<double> param_magnitude;
+    bool structure_analyzed = false;
+    // equations, params and param values of the last rank test. When the params still come
+    // first with the same values, the rows of the equations still in front are kept by the
+    // dense backend.
+    std::vector<std::shared_ptr<Expr>> rank_sources;
+    std::vector<std::shared_ptr<Param<double>>> rank_params;
+    std::vector<double> rank_values;
 
     std::vector<std::shared_ptr<Expr>> source_equations;
     std::vector<std::shared_ptr<Param<double>>> parameters;
+    // position of every param in parameters and of every equation in source_equations, an
+    // equation added more than once has an entry per position. Removal swaps the last element
+    // into the hole, so both vectors are only ordered by insertion until something is removed.
+    std::unordered_map<const Param<double>*, std::size_t> parameter_index;
+    std::unordered_multimap<const Expr*, std::size_t> source_equation_index;
 
     std::vector<std::shared_ptr<Expr>> equations;
+    // source equation each of `equations` was derived from
+    std::vector<std::shared_ptr<Expr>> equation_sources;
     std::vector<std::shared_ptr<Param<double>>> current_params;
 
-    std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Param<double>>> subs;
+    // eliminated param -> expression of a remaining param (or constants) it equals
+    std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Expr>> subs;
+    // current_params followed by the rest of parameters, bound while solve() runs
+    ParamStore param_store;
+    // param_store index of every param in subs, with its expression
+    std::vector<std::pair<std::size_t, std::shared_ptr<Expr>>> substituted;
+
+    // params the equations depend on that are not solved for (constraint values, fixed params)
+    std::vector<std::shared_ptr<Param<double>>> input_params;
+    std::vector<double> input_values;
+    std::size_t structure_hash = 0;
+    std::size_t last_configuration_key = 0;
+
+    // most recently used first
+    std::list<WarmStartEntry> warm_starts;
+    std::unordered_map<std::size_t, std::list<WarmStartEntry>::iterator> warm_start_index;
 
     void add_equation(const std::shared_ptr<Expr>& eq);
     void add_equation(const ExpVector& v);
@@ -57,9 +234,14 @@ public:
 
     void remove_parameter(const std::shared_ptr<Param<double>>& p);
 
+    bool is_parallel() const;
     void eval(xt::xtensor<double, 1>& B, bool clear_drag);
 
-    bool is_converged(bool check_drag, bool print_non_converged = false);
+    double residual_tolerance(std::size_t i) const;
+    // appends the equations that are not within tolerance to `not_converged`, if given,
+    // instead of stopping at the first one
+    bool is_converged(bool check_drag, std::vector<std::string>* not_converged = nullptr);
+    void store_param_magnitudes();
     void store_params();
     void revert_params();
 
@@ -72,17 +254,48 @@ public:
                        bool clear_drag);
     void solve_least_squares(const xt::xtensor<double, 2>& A, const xt::xtensor<double, 1>& B,
                              xt::xtensor<double, 1>& X);
+    // AAT * Z = scaled_B with mixed precision, false if the refinement didn't converge
+    bool solve_mixed_precision();
+    void write_sparse_jacobian();
+    void eval_sparse_jacobian(bool clear_drag);
+    // minimum norm least squares solution of A X = B with LSQR on the sparse Jacobian, rows
+    // scaled to unit norm (which keeps the solution of a consistent system)
+    void solve_lsqr(const xt::xtensor<double, 1>& B, xt::xtensor<double, 1>& X);
+    // A * A^T using only the non-zeros of jacobian_pattern
+    void form_normal_matrix(const xt::xtensor<double, 2>& A, xt::xtensor<double, 2>& AAT);
+    // least squares step into X with the kept factorization, refactoring when needed
+    void kept_step(bool drag_rows);
+    // f . (A X) with the Jacobian X was computed from
+    double step_slope(bool drag_rows);
+    // moves the params by -step_scale * X with the line search. Returns true if B holds the
+    // residual there, false if no step decreased |f|^2 enough and the least bad one was taken.
+    bool take_step(bool clear_drag, double& step_scale);
     void clear();
 
+    void analyze_structure();
+    std::size_t structural_rank();
+    int structural_dof();
+    // equations of the structurally over-determined part, empty if there is none
+    std::vector<std::shared_ptr<Expr>> structurally_conflicting_equations();
+
+    // the numeric rank of dense systems, the structural one of sparse systems
     bool test_rank(int& dof);
+    // source equations that are linear combinations of the others at the current values,
+    // for sparse systems only the structurally conflicting ones
+    std::vector<std::shared_ptr<Expr>> find_dependent_equations();
 
     void update_dirty();
 
-    void back_substitution(
-        std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Param<double>>>& subs);
-    std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Param<double>>>
+    // sets the substituted params from the values of the unknowns
+    void back_substitution();
+    std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Expr>>
     solve_by_substitution();
 
+    std::size_t configuration_key();
+    bool warm_start(std::size_t key);
+    void remember_solution(std::size_t key);
+    void clear_warm_starts();
+
     SolveResult solve();
 };
 
@@ -2,8 +2,11 @@
 #define ADJACENT_EXPRESSION_HPP
 
 #include <memory>
+#include <atomic>
 #include <string>
 #include <cmath>
+#include <stdexcept>
+#include <unordered_map>
 
 class Expr;
 
@@ -24,6 +27,9 @@ class Param : public std::enable_shared_from_this<Param<T>>
 {
 private:
     T m_value;
+    // where value() reads and set_value() writes: m_value, or the slot of the ParamStore the
+    // param is bound to
+    T* m_slot = &m_value;
 
 public:
     std::string m_name;
@@ -34,10 +40,18 @@ public:
     Param() = default;
     Param(const std::string& name, bool reduceable = true);
     Param(const std::string& name, double value);
+    // copies the value, not the binding
+    Param(const Param& other);
+    Param& operator=(const Param&) = delete;
+
+    // moves the value to `slot` (see ParamStore::bind), unbind() moves it back. A param can
+    // only be bound to one slot at a time.
+    void bind(T* slot);
+    void unbind();
 
     std::string to_string() const
     {
-        return "(" + m_name + ":" + std::to_string(m_value) + ")";
+        return "(" + m_name + ":" + std::to_string(value()) + ")";
     }
 
     void set_value(const T& other);
@@ -51,26 +65,57 @@ public:
 template <class T>
 void Param<T>::set_value(const T& other)
 {
-    if (other == m_value)
+    if (other == *m_slot)
         return;
     m_changed = true;
-    m_value = other;
+    *m_slot = other;
 }
 
 template <class T>
 T Param<T>::value() const
 {
-    return m_value;
+    return *m_slot;
+}
+
+template <class T>
+Param<T>::Param(const Param& other)
+    : std::enable_shared_from_this<Param<T>>()
+    , m_value(other.value())
+    , m_name(other.m_name)
+    , m_reduceable(other.m_reduceable)
+    , m_changed(other.m_changed)
+    , m_expr(other.m_expr)
+{
+}
+
+template <class T>
+void Param<T>::bind(T* slot)
+{
+    if (m_slot != &m_value)
+        throw std::runtime_error("param " + m_name + " is already bound to a store");
+    *slot = *m_slot;
+    m_slot = slot;
 }
 
+template <class T>
+void Param<T>::unbind()
+{
+    m_value = *m_slot;
+    m_slot = &m_value;
+}
+
+// may be called from several threads, the first node published wins
 template <class T>
 std::shared_ptr<Expr> Param<T>::expr()
 {
-    if (m_expr == nullptr)
+    auto e = std::atomic_load(&m_expr);
+    if (e == nullptr)
     {
-        m_expr = std::make_shared<Expr>(this->shared_from_this());
+        auto created = std::make_shared<Expr>(this->shared_from_this());
+        if (std::atomic_compare_exchange_strong(&m_expr, &e, created))
+            e = created;
     }
-    return m_expr;
+    return e;
 }
 
 template <class T>
@@ -145,9 +190,10 @@ public:
 
     Expr(const Op& op, const std::shared_ptr<Expr>& a, const std::shared_ptr<Expr>& b);
 
+    // this - to, marked so the solver can treat it as a soft (drag) equation
     std::shared_ptr<Expr> drag(const std::shared_ptr<Expr>& to)
     {
-        return std::make_shared<Expr>(Op::Drag, std::shared_ptr<Expr>(this), to);
+        return std::make_shared<Expr>(Op::Drag, shared_from_this(), to);
     }
 
     bool is_zero_const() const;
@@ -177,14 +223,16 @@ public:
     void substitute(std::shared_ptr<Param<double>>& pa, std::shared_ptr<Param<double>>& pb);
     void substitute(std::shared_ptr<Param<double>>& p, std::shared_ptr<Expr> e);
 
+    // returns a copy with every param in `subs` replaced, unchanged subtrees are shared
+    std::shared_ptr<Expr> substituted(
+        const std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Expr>>& subs);
+
     bool has_two_operands() const;
     Op get_op() const;
 };
 
-static std::shared_ptr<Expr> zero = std::make_shared<Expr>(0.), one = std::make_shared<Expr>(1.),
-                             mOne = std::make_shared<Expr>(-1.), two = std::make_shared<Expr>(2.0),
-                             PI_E = std::make_shared<Expr>(M_PI),
-                             PI2_E = std::make_shared<Expr>(M_PI * 2);
+// shared by all expressions (and threads), defined once in expression.cpp
+extern const std::shared_ptr<Expr> zero, one, mOne, two, PI_E, PI2_E;
 
 std::shared_ptr<Expr> expr(double);
 
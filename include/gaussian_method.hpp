@@ -8,6 +8,8 @@ class GaussianMethod
 public:
     static constexpr double epsilon = 1e-10;
     static constexpr double rank_epsilon = 1e-8;
+    // columns eliminated together by solve
+    static constexpr std::size_t panel = 32;
 
     // copy A so it doesn't get overwritten
     // note: could use xt::linalg::rank
@@ -16,6 +18,9 @@ public:
     // copy A & B so they don't get overwritten
     static void solve(xt::xtensor<double, 2> A, xt::xtensor<double, 1> B,
                       xt::xtensor<double, 1>& X);
+    // same as solve, but eliminates in A & B themselves instead of copies
+    static void solve_in_place(xt::xtensor<double, 2>& A, xt::xtensor<double, 1>& B,
+                               xt::xtensor<double, 1>& X);
 };
 
 #endif
\ No newline at end of file
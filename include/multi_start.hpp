@@ -0,0 +1,29 @@
+#ifndef ADJACENT_MULTI_START_HPP
+#define ADJACENT_MULTI_START_HPP
+
+#include <memory>
+#include <functional>
+
+#include "equation_system.hpp"
+#include "thread_pool.hpp"
+
+struct MultiStartResult
+{
+    static constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+    std::size_t best = none;
+    double residual = -1.0;
+    bool converged = false;
+};
+
+// Runs candidate(i, control) for i in [0, candidates), each candidate solving in its own
+// workspace and returning its final residual. Candidates run concurrently on `pool`
+// (serially if it is null). The converged candidate with the lowest index wins, all
+// candidates after it are cancelled through their control. Without a converged candidate
+// the lowest residual wins.
+MultiStartResult multi_start(
+    std::size_t candidates,
+    const std::function<double(std::size_t, const std::shared_ptr<SolveControl>&)>& candidate,
+    ThreadPool* pool, double converged_residual = GaussianMethod::epsilon);
+
+#endif
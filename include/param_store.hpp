@@ -0,0 +1,88 @@
+#ifndef ADJACENT_PARAM_STORE_HPP
+#define ADJACENT_PARAM_STORE_HPP
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "expression.hpp"
+
+// The params of a system as structure of arrays: values, reduceable flags and names, addressed
+// by their index in the store. While the store is bound the params read and write their values
+// in values(), so a solver can save, restore and step all of them with bulk copies and the
+// expressions read them from one array.
+//
+// A param is bound to one store at a time, binding it to a second one throws, so systems
+// sharing params can't be solved concurrently (which never worked, they would race on the
+// values). While bound, reading or writing a param from another thread races with the
+// solve, see Sketch::update_async.
+class ParamStore
+{
+public:
+    static constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+    ParamStore() = default;
+    ParamStore(const ParamStore&) = delete;
+    ParamStore& operator=(const ParamStore&) = delete;
+    ~ParamStore();
+
+    // the store holds `params` in this order, each once. A bound store binds the new ones.
+    void assign(const std::vector<ParamPtr>& params);
+    void clear();
+
+    std::size_t size() const;
+    // index of `p`, none if it isn't in the store
+    std::size_t find(const Param<double>* p) const;
+
+    const ParamPtr& param(std::size_t i) const;
+    const std::string& name(std::size_t i) const;
+    bool reduceable(std::size_t i) const;
+
+    // the values of the params, only current while the store is bound
+    double* values();
+    const double* values() const;
+    // the value of param i, bound or not
+    double value(std::size_t i) const;
+    void set_value(std::size_t i, double v);
+
+    void bind();
+    // hands the values back to the params, the ones that changed are flagged m_changed
+    void unbind();
+    bool is_bound() const;
+
+    // values of all the params into `to`, or back from `from`
+    void save(double* to) const;
+    void restore(const double* from);
+
+private:
+    std::vector<ParamPtr> m_params;
+    std::vector<double> m_values;
+    std::vector<char> m_reduceable;
+    // values when the store was bound
+    std::vector<double> m_bound_values;
+    std::unordered_map<const Param<double>*, std::size_t> m_index;
+    bool m_bound = false;
+};
+
+// keeps a store bound for the lifetime of the scope
+class ParamStoreBinding
+{
+public:
+    explicit ParamStoreBinding(ParamStore& store)
+        : m_store(store)
+    {
+        m_store.bind();
+    }
+    ~ParamStoreBinding()
+    {
+        m_store.unbind();
+    }
+    ParamStoreBinding(const ParamStoreBinding&) = delete;
+    ParamStoreBinding& operator=(const ParamStoreBinding&) = delete;
+
+private:
+    ParamStore& m_store;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef ADJACENT_RANK_REVEALING_QR_HPP
+#define ADJACENT_RANK_REVEALING_QR_HPP
+
+#include <vector>
+
+#include <xtensor/xtensor.hpp>
+
+// Row-pivoted QR of A (i.e. column-pivoted QR of A^T), computed with twice-applied
+// modified Gram-Schmidt. Q is kept as an orthonormal basis of the row space so rows
+// can be appended later without refactoring the ones already processed.
+class RankRevealingQR
+{
+public:
+    // a row is dependent if |residual|^2 <= tolerance * max(1, |row|^2)
+    double tolerance = 1e-8;
+
+    void clear();
+
+    void factorize(const xt::xtensor<double, 2>& A);
+    // append rows [first, A.shape(0)) of A, rows before `first` must be the factored ones.
+    // A may have more columns than them if they are 0 in the new ones.
+    void add_rows(const xt::xtensor<double, 2>& A, std::size_t first);
+
+    std::size_t rank() const;
+    std::size_t rows() const;
+    std::size_t cols() const;
+
+    // indices of rows that are linear combinations of the others
+    const std::vector<std::size_t>& dependent_rows() const;
+    // independent rows in pivot order, with the norms of their residuals (diagonal of R)
+    const std::vector<std::size_t>& pivots() const;
+    const std::vector<double>& diagonal() const;
+
+private:
+    void process(std::size_t first, std::size_t count);
+    // pads the rows and the basis with zero columns up to `cols`
+    void widen(std::size_t cols);
+    void project_out(double* w) const;
+
+    std::size_t m_rows_count = 0;
+    std::size_t m_cols = 0;
+    std::vector<double> m_rows;
+    std::vector<double> m_basis;
+    std::vector<double> m_work;
+    std::vector<std::size_t> m_pivots;
+    std::vector<double> m_diagonal;
+    std::vector<std::size_t> m_dependent;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef ADJACENT_RECORDER_HPP
+#define ADJACENT_RECORDER_HPP
+
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include "expression.hpp"
+
+class Entity;
+class PointE;
+class Constraint;
+class Sketch;
+
+// Operation log of a Sketch editing session, one operation per line:
+//
+//   param <pid> <name> <value>                 a param seen for the first time
+//   point <eid> <pid x> <pid y> <pid z>        entity definitions, also emitted on first use
+//   line <eid> <6 x pid>
+//   circle <eid> <pid x> <pid y> <pid z> <pid radius>
+//   constraint <cid> <type> <entity count> <eids...> <type specific fields>
+//                                              ending in <value> <reference> for value
+//                                              constraints, after <supplementary> for angles
+//   add_entity <eid>
+//   add_constraint <cid>
+//   remove_entity <eid>                        after removing the constraints on it
+//   remove_constraint <cid>
+//   set_value <cid> <value>
+//   drag <eid> <x> <y>
+//   begin_drag <eid>
+//   update_drag <eid> <x> <y> <result>
+//   end_drag <eid>
+//   update <result>
+//
+// Only the structure and values are kept (names are the user visible param names), so a log
+// can be shared where the sketch itself cannot.
+class SketchRecorder
+{
+public:
+    explicit SketchRecorder(std::ostream& out);
+
+    void add_entity(Entity* e);
+    void add_constraint(Constraint* c);
+    void remove_entity(Entity* e);
+    void remove_constraint(Constraint* c);
+    void set_value(Constraint* c, double value);
+    void drag(PointE* p, double x, double y);
+    void begin_drag(PointE* p);
+    void update_drag(PointE* p, double x, double y, int result);
+    void end_drag(PointE* p);
+    void update(int result);
+
+private:
+    std::size_t param_id(const ParamPtr& p);
+    std::size_t entity_id(Entity* e);
+    std::size_t constraint_id(Constraint* c);
+
+    std::ostream& m_out;
+    std::unordered_map<ParamPtr, std::size_t> m_params;
+    std::unordered_map<Entity*, std::size_t> m_entities;
+    std::unordered_map<Constraint*, std::size_t> m_constraints;
+};
+
+struct ReplayStep
+{
+    std::size_t line = 0;
+    std::string op;
+    double seconds = 0.0;
+    // result of an update, and the one that was recorded
+    int result = -1;
+    int recorded_result = -1;
+};
+
+// Re-executes a log recorded by SketchRecorder on `sketch`, calling `on_step` after every
+// add/remove_entity, add/remove_constraint, set_value, drag and update (and the drag session
+// operations) with how long it took.
+// Throws std::runtime_error on a malformed log.
+void replay(std::istream& in, Sketch& sketch,
+            const std::function<void(const ReplayStep&)>& on_step = nullptr);
+
+#endif
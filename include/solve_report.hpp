@@ -0,0 +1,60 @@
+#ifndef ADJACENT_SOLVE_REPORT_HPP
+#define ADJACENT_SOLVE_REPORT_HPP
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <functional>
+
+struct SolveIteration
+{
+    // Euclidean norms of the residual vector before the step and of the Newton step
+    double residual_norm = 0.0;
+    double step_norm = 0.0;
+    // fraction of the step the line search took
+    double step_scale = 1.0;
+};
+
+// What one EquationSystem::solve did and where the time went
+struct SolveReport
+{
+    int result = 0;
+    std::size_t equations = 0;
+    std::size_t unknowns = 0;
+    // params eliminated by substitution before the Newton iterations
+    std::size_t substitutions = 0;
+    std::vector<SolveIteration> iterations;
+    // dense steps solved with EquationSystem::mixed_precision, and those of them that had to
+    // be solved again in double
+    std::size_t single_precision_steps = 0;
+    std::size_t double_precision_fallbacks = 0;
+    // equations still above their tolerance when the solve failed
+    std::vector<std::string> not_converged;
+
+    // wall-clock seconds per phase
+    double update_dirty_seconds = 0.0;
+    double eval_seconds = 0.0;
+    double eval_jacobian_seconds = 0.0;
+    double least_squares_seconds = 0.0;
+    double total_seconds = 0.0;
+
+    void clear()
+    {
+        result = 0;
+        equations = unknowns = substitutions = 0;
+        iterations.clear();
+        single_precision_steps = double_precision_fallbacks = 0;
+        not_converged.clear();
+        update_dirty_seconds = eval_seconds = eval_jacobian_seconds = least_squares_seconds = 0.0;
+        total_seconds = 0.0;
+    }
+
+    std::string to_string() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const SolveReport& report);
+
+// Receives the report at the end of every solve. No timings are taken while unset.
+using SolveReportSink = std::function<void(const SolveReport&)>;
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef ADJACENT_SPATIAL_INDEX_HPP
+#define ADJACENT_SPATIAL_INDEX_HPP
+
+#include <cstddef>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+class Entity;
+class PointE;
+
+struct SpatialHit
+{
+    Entity* entity = nullptr;
+    // the point that was hit: the entity itself, or for nearest_point an end point of a line
+    // or the center of a circle. Null when a curve was hit.
+    PointE* point = nullptr;
+    // from the query point, or along the ray
+    double distance = 0.0;
+};
+
+// Bounding volume hierarchy over the xy bounds of PointE, LineE and CircleE entities, for hit
+// testing and finding coincident geometry. The bounds are taken from the param values by
+// refresh(), which refits the tree and only rebuilds it after inserts, removals or when the
+// refitted boxes got much looser than the built ones. Other entity types are ignored.
+//
+// Queries refresh first if invalidate() was called since the last refresh, so an owner only
+// has to invalidate when the values change (after a solve). When only some entities moved
+// (a drag frame) it calls moved() for them instead, and only their boxes and the nodes above
+// them are refitted.
+class SpatialIndex
+{
+public:
+    static constexpr double infinity = std::numeric_limits<double>::infinity();
+    static constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+    void insert(Entity* e);
+    void remove(Entity* e);
+    void clear();
+    std::size_t size() const;
+
+    // the param values changed, the next query refreshes
+    void invalidate();
+    // the params of `e` changed, the next query refits its box
+    void moved(Entity* e);
+    void refresh();
+
+    // closest point (point entities, end points of lines and centers of circles) to (x, y)
+    // within max_distance, entity is null if there is none
+    SpatialHit nearest_point(double x, double y, double max_distance = infinity);
+    // entities with a point within `radius` of (x, y), closest first
+    void within_radius(double x, double y, double radius, std::vector<SpatialHit>& hits);
+    // entities passing within `tolerance` of the ray from (x, y) along (dx, dy), with the
+    // distance along the ray to where they were hit, nearest first
+    void ray(double x, double y, double dx, double dy, double tolerance,
+             std::vector<SpatialHit>& hits);
+
+private:
+    enum Kind
+    {
+        PointKind,
+        LineKind,
+        CircleKind,
+    };
+
+    struct Box
+    {
+        double min_x = infinity;
+        double min_y = infinity;
+        double max_x = -infinity;
+        double max_y = -infinity;
+
+        void add(const Box& b);
+        bool operator==(const Box& b) const;
+        // half the perimeter, which unlike the area isn't 0 for points and axis aligned lines
+        double extent() const;
+        double distance(double x, double y) const;
+    };
+
+    struct Item
+    {
+        Entity* entity;
+        Kind kind;
+        Box box;
+        // the leaf holding the item, and whether it is in m_moved
+        std::size_t leaf = none;
+        bool moved = false;
+    };
+
+    // leaves hold items m_order[first] ... m_order[first + count - 1], inner nodes have count 0
+    // and their children at left and left + 1
+    struct Node
+    {
+        Box box;
+        std::size_t parent = none;
+        std::size_t left = 0;
+        std::size_t first = 0;
+        std::size_t count = 0;
+    };
+
+    void update_box(Item& item) const;
+    void build();
+    void split(std::size_t node);
+    void fit(Node& node);
+    // recomputes the node boxes bottom up, returning the sum of their extents
+    double refit();
+    // updates the boxes of the moved items and the nodes above them
+    void refit_moved();
+    void prepare();
+
+    std::vector<Item> m_items;
+    std::unordered_map<Entity*, std::size_t> m_index;
+    std::vector<Node> m_nodes;
+    std::vector<std::size_t> m_order;
+    std::vector<std::size_t> m_stack;
+    std::vector<std::size_t> m_moved;
+    // sum of the node extents when the tree was built, and now
+    double m_built_extent = 0.0;
+    double m_extent = 0.0;
+    bool m_rebuild = false;
+    bool m_stale = false;
+};
+
+#endif
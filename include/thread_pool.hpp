@@ -0,0 +1,63 @@
+#ifndef ADJACENT_THREAD_POOL_HPP
+#define ADJACENT_THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Work-stealing pool: every worker owns a deque, runs its tasks in submission order and
+// steals the newest tasks of the others when it runs dry. Submitting the most expensive tasks
+// first therefore starts them first (see solve_batch).
+class ThreadPool
+{
+public:
+    // 0 picks one worker per hardware thread
+    explicit ThreadPool(std::size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t size() const;
+
+    // process wide pool, created on first use
+    static ThreadPool& shared();
+
+    // tasks submitted from a worker go to its own deque, others are spread round-robin
+    void submit(std::function<void()> task);
+
+    // runs one queued task on the calling thread, false if there was none
+    bool try_run_one();
+
+    // calls fn(begin, end) for consecutive ranges of [0, n) with at least `grain` elements
+    // and returns when all of them are done. The calling thread takes part, so it is safe
+    // to call from inside a task of the same pool.
+    void parallel_for(std::size_t n, std::size_t grain,
+                      const std::function<void(std::size_t, std::size_t)>& fn);
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void worker(std::size_t index);
+    bool pop(std::size_t index, std::function<void()>& task);
+    bool steal(std::size_t thief, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<std::size_t> m_next_queue{ 0 };
+    std::atomic<std::size_t> m_pending{ 0 };
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_sleep_cv;
+    bool m_stop = false;
+};
+
+#endif
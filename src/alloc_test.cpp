@@ -0,0 +1,168 @@
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "constraint.hpp"
+
+// Checks that once update_dirty() has run, solve() doesn't touch the heap: every operator new
+// made while `counting` is set is counted and the test fails if there was any.
+
+namespace
+{
+    std::atomic<bool> counting{ false };
+    std::atomic<std::size_t> allocations{ 0 };
+
+    void* allocate(std::size_t size)
+    {
+        if (counting.load(std::memory_order_relaxed))
+            allocations.fetch_add(1, std::memory_order_relaxed);
+        if (void* p = std::malloc(size == 0 ? 1 : size))
+            return p;
+        throw std::bad_alloc();
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    // chain of lines with lengths and every third one horizontal, `n` lines long
+    std::unique_ptr<Sketch> make_chain(int n, std::shared_ptr<PointE>& end)
+    {
+        auto sketch = std::make_unique<Sketch>();
+        auto prev = std::make_shared<PointE>(param("x", 0), param("y", 0), param("z", 0));
+        for (int i = 0; i < n; i++)
+        {
+            auto next = std::make_shared<PointE>(param("x", prev->x->value() + 0.9),
+                                                 param("y", prev->y->value() + 0.3),
+                                                 param("z", 0));
+            auto line = std::make_shared<LineE>(*prev, *next);
+            sketch->add_entity(line);
+            sketch->add_constraint(std::make_shared<LengthConstraint>(line, 1.0));
+            if (i % 3 == 0)
+                sketch->add_constraint(std::make_shared<HVConstraint>(line, OX));
+            prev = next;
+        }
+        end = prev;
+        return sketch;
+    }
+
+    int failures = 0;
+
+    // runs `step` a few times untracked to warm up, then counts the allocations of the rest
+    void check(const std::string& name, const std::function<SolveResult(int)>& step)
+    {
+        for (int i = 0; i < 3; i++)
+            step(i);
+        allocations = 0;
+        counting = true;
+        int not_okay = 0;
+        for (int i = 3; i < 23; i++)
+            not_okay += step(i) != OKAY;
+        counting = false;
+        std::size_t count = allocations;
+        std::cout << name << ": " << count << " allocations";
+        if (not_okay > 0)
+            std::cout << ", " << not_okay << " solves not OKAY";
+        std::cout << "\n";
+        if (count > 0 || not_okay > 0)
+            failures++;
+    }
+
+    // moves the free end of the chain and solves `sys` again
+    void check_system(const std::string& name, EquationSystem& sys, const ParamPtr& moved)
+    {
+        double start = moved->value();
+        check(name, [&](int i) {
+            moved->set_value(start + 0.01 * (i % 5));
+            return sys.solve();
+        });
+    }
+}
+
+int main()
+{
+    std::shared_ptr<PointE> end;
+    auto sketch = make_chain(12, end);
+
+    {
+        EquationSystem sys;
+        sketch->generate_equations(sys);
+        sys.linear_solver = LINEAR_DENSE;
+        check_system("dense", sys, end->y);
+    }
+    {
+        EquationSystem sys;
+        sketch->generate_equations(sys);
+        sys.linear_solver = LINEAR_DENSE;
+        sys.keep_factorization = true;
+        check_system("kept factorization", sys, end->y);
+    }
+    {
+        EquationSystem sys;
+        sketch->generate_equations(sys);
+        sys.linear_solver = LINEAR_DENSE;
+        sys.mixed_precision = true;
+        check_system("mixed precision", sys, end->y);
+    }
+    {
+        EquationSystem sys;
+        sketch->generate_equations(sys);
+        sys.linear_solver = LINEAR_LSQR;
+        check_system("lsqr", sys, end->y);
+    }
+    {
+        EquationSystem sys;
+        sketch->generate_equations(sys);
+        std::size_t steps = 0;
+        sys.report_sink = [&steps](const SolveReport& report) {
+            steps += report.iterations.size();
+        };
+        check_system("with report", sys, end->y);
+    }
+    {
+        double x = end->x->value();
+        double y = end->y->value();
+        sketch->begin_drag(end);
+        check("drag", [&](int i) { return sketch->update_drag(x - 0.05 * i, y + 0.02 * i); });
+        sketch->end_drag();
+    }
+
+    if (failures > 0)
+    {
+        std::cout << failures << " check(s) failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "batch_solve.hpp"
+
+#include <chrono>
+#include <numeric>
+#include <algorithm>
+
+namespace
+{
+    // cheap size estimate before any equations are generated
+    std::size_t estimate_cost(const Sketch& s)
+    {
+        if (!s.is_topology_changed())
+            return s.sys.equations.size() * s.sys.current_params.size() + 1;
+        return (s.entities.size() + s.constraints.size()) * (s.entities.size() + 1);
+    }
+}
+
+std::vector<BatchSolveStats> solve_batch(const std::vector<Sketch*>& sketches, ThreadPool& pool)
+{
+    std::vector<BatchSolveStats> stats(sketches.size());
+    std::vector<std::size_t> order(sketches.size());
+    std::vector<std::size_t> cost(sketches.size());
+    std::iota(order.begin(), order.end(), 0);
+    for (std::size_t i = 0; i < sketches.size(); i++)
+        cost[i] = estimate_cost(*sketches[i]);
+    std::stable_sort(order.begin(), order.end(),
+                     [&cost](std::size_t a, std::size_t b) { return cost[a] > cost[b]; });
+
+    std::atomic<std::size_t> remaining{ sketches.size() };
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    for (std::size_t i : order)
+    {
+        pool.submit([&, i] {
+            auto start = std::chrono::steady_clock::now();
+            Sketch& s = *sketches[i];
+            stats[i].result = s.update();
+            stats[i].equations = s.sys.equations.size();
+            stats[i].unknowns = s.sys.current_params.size();
+            stats[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                             - start)
+                                   .count();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--remaining == 0)
+                cv.notify_all();
+        });
+    }
+
+    while (remaining.load() > 0)
+    {
+        if (pool.try_run_one())
+            continue;
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&remaining] { return remaining.load() == 0; });
+    }
+    // the last task may still hold the lock
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
@@ -0,0 +1,162 @@
+#include "bipartite_matching.hpp"
+
+void SparsityPattern::clear(std::size_t cols_count)
+{
+    n_cols = cols_count;
+    row_start.assign(1, 0);
+    cols.clear();
+}
+
+void BipartiteMatching::compute(const SparsityPattern& pattern)
+{
+    std::size_t rows = pattern.rows();
+    row_match.assign(rows, none);
+    col_match.assign(pattern.n_cols, none);
+    m_dist.resize(rows);
+    m_next.resize(rows);
+    m_size = 0;
+
+    // greedy initial matching, most rows get matched here
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        for (std::size_t k = pattern.row_start[r]; k < pattern.row_start[r + 1]; k++)
+        {
+            std::size_t c = pattern.cols[k];
+            if (col_match[c] != none)
+                continue;
+            row_match[r] = c;
+            col_match[c] = r;
+            m_size++;
+            break;
+        }
+    }
+
+    while (bfs(pattern))
+    {
+        for (std::size_t r = 0; r < rows; r++)
+            m_next[r] = pattern.row_start[r];
+        for (std::size_t r = 0; r < rows; r++)
+        {
+            if (row_match[r] == none && dfs(pattern, r))
+                m_size++;
+        }
+    }
+}
+
+std::size_t BipartiteMatching::size() const
+{
+    return m_size;
+}
+
+// layers the rows by alternating path length from the free rows
+bool BipartiteMatching::bfs(const SparsityPattern& pattern)
+{
+    const std::size_t inf = none;
+    std::size_t rows = pattern.rows();
+    m_queue.clear();
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        if (row_match[r] == none)
+        {
+            m_dist[r] = 0;
+            m_queue.push_back(r);
+        }
+        else
+        {
+            m_dist[r] = inf;
+        }
+    }
+
+    m_free_dist = inf;
+    for (std::size_t i = 0; i < m_queue.size(); i++)
+    {
+        std::size_t r = m_queue[i];
+        if (m_dist[r] >= m_free_dist)
+            continue;
+        for (std::size_t k = pattern.row_start[r]; k < pattern.row_start[r + 1]; k++)
+        {
+            std::size_t w = col_match[pattern.cols[k]];
+            if (w == none)
+            {
+                if (m_free_dist == inf)
+                    m_free_dist = m_dist[r] + 1;
+            }
+            else if (m_dist[w] == inf)
+            {
+                m_dist[w] = m_dist[r] + 1;
+                m_queue.push_back(w);
+            }
+        }
+    }
+    return m_free_dist != inf;
+}
+
+// iterative search for an augmenting path along the bfs layers,
+// m_via[i] is the column leading from m_stack[i] to m_stack[i + 1]
+bool BipartiteMatching::dfs(const SparsityPattern& pattern, std::size_t root)
+{
+    m_stack.assign(1, root);
+    m_via.clear();
+    while (!m_stack.empty())
+    {
+        std::size_t r = m_stack.back();
+        if (m_next[r] == pattern.row_start[r + 1])
+        {
+            m_dist[r] = none;
+            m_stack.pop_back();
+            if (!m_via.empty())
+                m_via.pop_back();
+            continue;
+        }
+
+        std::size_t c = pattern.cols[m_next[r]++];
+        std::size_t w = col_match[c];
+        if (w == none)
+        {
+            if (m_dist[r] + 1 != m_free_dist)
+                continue;
+            m_via.push_back(c);
+            for (std::size_t i = 0; i < m_stack.size(); i++)
+            {
+                row_match[m_stack[i]] = m_via[i];
+                col_match[m_via[i]] = m_stack[i];
+            }
+            return true;
+        }
+        if (m_dist[w] == m_dist[r] + 1)
+        {
+            m_via.push_back(c);
+            m_stack.push_back(w);
+        }
+    }
+    return false;
+}
+
+std::vector<std::size_t> BipartiteMatching::overdetermined_rows(
+    const SparsityPattern& pattern) const
+{
+    std::size_t rows = pattern.rows();
+    std::vector<bool> visited(rows, false);
+    std::vector<std::size_t> res;
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        if (row_match[r] != none)
+            continue;
+        visited[r] = true;
+        res.push_back(r);
+    }
+
+    for (std::size_t i = 0; i < res.size(); i++)
+    {
+        std::size_t r = res[i];
+        for (std::size_t k = pattern.row_start[r]; k < pattern.row_start[r + 1]; k++)
+        {
+            std::size_t w = col_match[pattern.cols[k]];
+            if (w == none || visited[w])
+                continue;
+            visited[w] = true;
+            res.push_back(w);
+        }
+    }
+    return res;
+}
@@ -0,0 +1,183 @@
+#include "cholesky.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void Cholesky::clear()
+{
+    m_n = 0;
+    m_l.clear();
+    m_skip.clear();
+}
+
+void Cholesky::factorize(const xt::xtensor<double, 2>& M)
+{
+    std::size_t n = M.shape(0);
+    m_n = n;
+    m_l.assign(n * n, 0.0);
+    m_skip.assign(n, 0);
+
+    double max_diagonal = 0.0;
+    for (std::size_t i = 0; i < n; i++)
+        max_diagonal = std::max(max_diagonal, M(i, i));
+    double threshold = tolerance * std::max(max_diagonal, 1.0);
+
+    // row-oriented (Cholesky-Crout), L is stored row-major in the lower triangle
+    for (std::size_t j = 0; j < n; j++)
+    {
+        double* lj = &m_l[j * n];
+        double d = M(j, j);
+        for (std::size_t k = 0; k < j; k++)
+            d -= lj[k] * lj[k];
+        if (d <= threshold)
+        {
+            m_skip[j] = 1;
+            continue;
+        }
+        double ljj = std::sqrt(d);
+        lj[j] = ljj;
+        for (std::size_t i = j + 1; i < n; i++)
+        {
+            double* li = &m_l[i * n];
+            double s = M(i, j);
+            for (std::size_t k = 0; k < j; k++)
+                s -= li[k] * lj[k];
+            li[j] = s / ljj;
+        }
+    }
+}
+
+void Cholesky::solve(const xt::xtensor<double, 1>& b, xt::xtensor<double, 1>& x) const
+{
+    std::size_t n = m_n;
+    // L y = b
+    for (std::size_t i = 0; i < n; i++)
+    {
+        if (m_skip[i])
+        {
+            x(i) = 0.0;
+            continue;
+        }
+        const double* li = &m_l[i * n];
+        double s = b(i);
+        for (std::size_t k = 0; k < i; k++)
+            s -= li[k] * x(k);
+        x(i) = s / li[i];
+    }
+    // L^T x = y, by rows of L so the memory is walked contiguously
+    for (std::size_t i = n; i-- > 0;)
+    {
+        if (m_skip[i])
+        {
+            x(i) = 0.0;
+            continue;
+        }
+        const double* li = &m_l[i * n];
+        double xi = x(i) / li[i];
+        x(i) = xi;
+        for (std::size_t k = 0; k < i; k++)
+            x(k) -= li[k] * xi;
+    }
+}
+
+std::size_t Cholesky::size() const
+{
+    return m_n;
+}
+
+std::size_t Cholesky::skipped() const
+{
+    return std::count(m_skip.begin(), m_skip.end(), 1);
+}
+
+void SingleCholesky::clear()
+{
+    m_n = 0;
+    m_u.clear();
+    m_skip.clear();
+}
+
+void SingleCholesky::factorize(const xt::xtensor<double, 2>& M)
+{
+    std::size_t n = M.shape(0);
+    m_n = n;
+    m_u.resize(n * n);
+    m_skip.assign(n, 0);
+
+    // upper triangle of M, the lower one is never read
+    double max_diagonal = 0.0;
+    for (std::size_t i = 0; i < n; i++)
+    {
+        max_diagonal = std::max(max_diagonal, M(i, i));
+        float* ui = &m_u[i * n];
+        for (std::size_t j = i; j < n; j++)
+            ui[j] = static_cast<float>(M(i, j));
+    }
+    float threshold = static_cast<float>(tolerance * std::max(max_diagonal, 1.0));
+
+    // right-looking: row k of U is finished, then subtracted from the trailing rows
+    for (std::size_t k = 0; k < n; k++)
+    {
+        float* uk = &m_u[k * n];
+        if (uk[k] <= threshold)
+        {
+            m_skip[k] = 1;
+            std::fill(uk + k, uk + n, 0.0f);
+            continue;
+        }
+        float ukk = std::sqrt(uk[k]);
+        uk[k] = ukk;
+        float inverse = 1.0f / ukk;
+        for (std::size_t j = k + 1; j < n; j++)
+            uk[j] *= inverse;
+        for (std::size_t i = k + 1; i < n; i++)
+        {
+            float f = uk[i];
+            if (f == 0.0f)
+                continue;
+            float* ui = &m_u[i * n];
+            for (std::size_t j = i; j < n; j++)
+                ui[j] -= f * uk[j];
+        }
+    }
+}
+
+void SingleCholesky::solve(const xt::xtensor<double, 1>& b, xt::xtensor<double, 1>& x) const
+{
+    std::size_t n = m_n;
+    for (std::size_t i = 0; i < n; i++)
+        x(i) = b(i);
+    // U^T y = b, column k of U^T is row k of U
+    for (std::size_t k = 0; k < n; k++)
+    {
+        if (m_skip[k])
+        {
+            x(k) = 0.0;
+            continue;
+        }
+        const float* uk = &m_u[k * n];
+        double yk = x(k) / uk[k];
+        x(k) = yk;
+        for (std::size_t i = k + 1; i < n; i++)
+            x(i) -= uk[i] * yk;
+    }
+    // U x = y
+    for (std::size_t k = n; k-- > 0;)
+    {
+        if (m_skip[k])
+        {
+            x(k) = 0.0;
+            continue;
+        }
+        const float* uk = &m_u[k * n];
+        double s = x(k);
+        for (std::size_t j = k + 1; j < n; j++)
+            s -= uk[j] * x(j);
+        x(k) = s / uk[k];
+    }
+}
+
+std::size_t SingleCholesky::size() const
+{
+    return m_n;
+}
@@ -0,0 +1,121 @@
+#include "dense_backend.hpp"
+
+#include <algorithm>
+
+#include "dense_kernels.hpp"
+#include "gaussian_method.hpp"
+
+const char* ReferenceBackend::name() const
+{
+    return "reference";
+}
+
+void ReferenceBackend::normal_matrix(const xt::xtensor<double, 2>& A,
+                                     const std::vector<double>& row_scale,
+                                     const std::vector<double>& col_scale,
+                                     xt::xtensor<double, 2>& M)
+{
+    // dot products of the rows of S = Dr A Dc, the scales are powers of two so S is exact.
+    // Jacobian rows are mostly zeros, a product only runs where both rows have non-zeros.
+    std::size_t rows = A.shape(0);
+    std::size_t cols = A.shape(1);
+    m_scaled.resize(rows * cols);
+    m_first.assign(rows, cols);
+    m_last.assign(rows, 0);
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        for (std::size_t c = 0; c < cols; c++)
+        {
+            double v = A(r, c) * row_scale[r] * col_scale[c];
+            m_scaled[r * cols + c] = v;
+            if (v == 0.0)
+                continue;
+            m_first[r] = std::min(m_first[r], c);
+            m_last[r] = c + 1;
+        }
+    }
+
+    // the lower triangle in tiles of syrk_rows rows by syrk_cols columns of S, so the rows
+    // a tile is multiplied with stay in cache, four of them at a time
+    const DenseKernels& kernels = dense_kernels();
+    const std::size_t syrk_rows = 64;
+    const std::size_t syrk_cols = 512;
+    const double* s = m_scaled.data();
+    M.fill(0.0);
+    for (std::size_t k0 = 0; k0 < cols; k0 += syrk_cols)
+    {
+        std::size_t k1 = std::min(k0 + syrk_cols, cols);
+        for (std::size_t c0 = 0; c0 < rows; c0 += syrk_rows)
+        {
+            std::size_t c1 = std::min(c0 + syrk_rows, rows);
+            for (std::size_t r = c0; r < rows; r++)
+            {
+                std::size_t first = std::max(k0, m_first[r]);
+                std::size_t last = std::min(k1, m_last[r]);
+                std::size_t end = std::min(c1, r + 1);
+                if (first >= last)
+                    continue;
+                std::size_t c = c0;
+                for (; c + 4 <= end; c += 4)
+                {
+                    std::size_t from = last;
+                    std::size_t to = first;
+                    for (std::size_t j = c; j < c + 4; j++)
+                    {
+                        from = std::min(from, m_first[j]);
+                        to = std::max(to, m_last[j]);
+                    }
+                    from = std::max(from, first);
+                    to = std::min(to, last);
+                    if (from >= to)
+                        continue;
+                    const double* y[4];
+                    for (std::size_t j = 0; j < 4; j++)
+                        y[j] = s + (c + j) * cols + from;
+                    kernels.dot4(to - from, s + r * cols + from, y, &M(r, c));
+                }
+                for (; c < end; c++)
+                {
+                    std::size_t from = std::max(first, m_first[c]);
+                    std::size_t to = std::min(last, m_last[c]);
+                    if (from < to)
+                        M(r, c) += kernels.dot(to - from, s + r * cols + from, s + c * cols + from);
+                }
+            }
+        }
+    }
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        for (std::size_t c = r + 1; c < rows; c++)
+            M(r, c) = M(c, r);
+    }
+}
+
+void ReferenceBackend::solve_normal(xt::xtensor<double, 2>& M, xt::xtensor<double, 1>& B,
+                                    xt::xtensor<double, 1>& X)
+{
+    GaussianMethod::solve_in_place(M, B, X);
+}
+
+std::size_t ReferenceBackend::rank(const xt::xtensor<double, 2>& A, std::size_t kept_rows)
+{
+    if (kept_rows > 0 && kept_rows == m_qr.rows() && A.shape(1) >= m_qr.cols())
+        m_qr.add_rows(A, m_qr.rows());
+    else
+        m_qr.factorize(A);
+    return m_qr.rank();
+}
+
+const std::vector<std::size_t>& ReferenceBackend::dependent_rows() const
+{
+    return m_qr.dependent_rows();
+}
+
+std::unique_ptr<DenseBackend> make_dense_backend()
+{
+#ifdef ADJACENT_USE_LAPACK
+    return std::make_unique<LapackBackend>();
+#else
+    return std::make_unique<ReferenceBackend>();
+#endif
+}
@@ -0,0 +1,257 @@
+#include "dense_kernels.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ADJACENT_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    void update_row_scalar(std::size_t n, std::size_t count, const double* coefs,
+                           const double* const* rows, double* y)
+    {
+        for (std::size_t k = 0; k < count; k++)
+        {
+            double c = coefs[k];
+            const double* x = rows[k];
+            for (std::size_t i = 0; i < n; i++)
+                y[i] -= c * x[i];
+        }
+    }
+
+    double dot_scalar(std::size_t n, const double* x, const double* y)
+    {
+        double sum = 0.0;
+        for (std::size_t i = 0; i < n; i++)
+            sum += x[i] * y[i];
+        return sum;
+    }
+
+    void dot4_scalar(std::size_t n, const double* x, const double* const* y, double* out)
+    {
+        for (std::size_t j = 0; j < 4; j++)
+            out[j] += dot_scalar(n, x, y[j]);
+    }
+
+#ifdef ADJACENT_X86_KERNELS
+    // y is kept in registers while all the rows are applied to it, 16 (AVX2) or 32 (AVX-512)
+    // doubles at a time so that the fused multiply-adds of different chunks overlap
+
+    __attribute__((target("avx2,fma"))) double hsum(__m256d v)
+    {
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+    __attribute__((target("avx2,fma"))) void update_row_avx2(std::size_t n, std::size_t count,
+                                                             const double* coefs,
+                                                             const double* const* rows,
+                                                             double* y)
+    {
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256d y0 = _mm256_loadu_pd(y + i);
+            __m256d y1 = _mm256_loadu_pd(y + i + 4);
+            __m256d y2 = _mm256_loadu_pd(y + i + 8);
+            __m256d y3 = _mm256_loadu_pd(y + i + 12);
+            for (std::size_t k = 0; k < count; k++)
+            {
+                __m256d c = _mm256_broadcast_sd(coefs + k);
+                const double* x = rows[k] + i;
+                y0 = _mm256_fnmadd_pd(c, _mm256_loadu_pd(x), y0);
+                y1 = _mm256_fnmadd_pd(c, _mm256_loadu_pd(x + 4), y1);
+                y2 = _mm256_fnmadd_pd(c, _mm256_loadu_pd(x + 8), y2);
+                y3 = _mm256_fnmadd_pd(c, _mm256_loadu_pd(x + 12), y3);
+            }
+            _mm256_storeu_pd(y + i, y0);
+            _mm256_storeu_pd(y + i + 4, y1);
+            _mm256_storeu_pd(y + i + 8, y2);
+            _mm256_storeu_pd(y + i + 12, y3);
+        }
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256d y0 = _mm256_loadu_pd(y + i);
+            for (std::size_t k = 0; k < count; k++)
+                y0 = _mm256_fnmadd_pd(_mm256_broadcast_sd(coefs + k),
+                                      _mm256_loadu_pd(rows[k] + i), y0);
+            _mm256_storeu_pd(y + i, y0);
+        }
+        for (; i < n; i++)
+        {
+            double v = y[i];
+            for (std::size_t k = 0; k < count; k++)
+                v -= coefs[k] * rows[k][i];
+            y[i] = v;
+        }
+    }
+
+    __attribute__((target("avx2,fma"))) double dot_avx2(std::size_t n, const double* x,
+                                                        const double* y)
+    {
+        __m256d s0 = _mm256_setzero_pd();
+        __m256d s1 = _mm256_setzero_pd();
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), s0);
+            s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), s1);
+        }
+        for (; i + 4 <= n; i += 4)
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), s0);
+        double sum = hsum(_mm256_add_pd(s0, s1));
+        for (; i < n; i++)
+            sum += x[i] * y[i];
+        return sum;
+    }
+
+    __attribute__((target("avx2,fma"))) void dot4_avx2(std::size_t n, const double* x,
+                                                      const double* const* y, double* out)
+    {
+        __m256d s0 = _mm256_setzero_pd();
+        __m256d s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd();
+        __m256d s3 = _mm256_setzero_pd();
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256d v = _mm256_loadu_pd(x + i);
+            s0 = _mm256_fmadd_pd(v, _mm256_loadu_pd(y[0] + i), s0);
+            s1 = _mm256_fmadd_pd(v, _mm256_loadu_pd(y[1] + i), s1);
+            s2 = _mm256_fmadd_pd(v, _mm256_loadu_pd(y[2] + i), s2);
+            s3 = _mm256_fmadd_pd(v, _mm256_loadu_pd(y[3] + i), s3);
+        }
+        double sum[4] = { hsum(s0), hsum(s1), hsum(s2), hsum(s3) };
+        for (; i < n; i++)
+        {
+            for (std::size_t j = 0; j < 4; j++)
+                sum[j] += x[i] * y[j][i];
+        }
+        for (std::size_t j = 0; j < 4; j++)
+            out[j] += sum[j];
+    }
+
+    // _mm512_reduce_add_pd, written out because GCC's version reads an undefined register
+    // (-Wuninitialized). The zero-masked extracts don't.
+    __attribute__((target("avx512f"))) double hsum512(__m512d v)
+    {
+        __m256d s = _mm256_add_pd(_mm512_maskz_extractf64x4_pd(0xff, v, 0),
+                                  _mm512_maskz_extractf64x4_pd(0xff, v, 1));
+        __m128d h = _mm_add_pd(_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+    }
+
+    __attribute__((target("avx512f"))) void update_row_avx512(std::size_t n, std::size_t count,
+                                                              const double* coefs,
+                                                              const double* const* rows,
+                                                              double* y)
+    {
+        std::size_t i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            __m512d y0 = _mm512_loadu_pd(y + i);
+            __m512d y1 = _mm512_loadu_pd(y + i + 8);
+            __m512d y2 = _mm512_loadu_pd(y + i + 16);
+            __m512d y3 = _mm512_loadu_pd(y + i + 24);
+            for (std::size_t k = 0; k < count; k++)
+            {
+                __m512d c = _mm512_set1_pd(coefs[k]);
+                const double* x = rows[k] + i;
+                y0 = _mm512_fnmadd_pd(c, _mm512_loadu_pd(x), y0);
+                y1 = _mm512_fnmadd_pd(c, _mm512_loadu_pd(x + 8), y1);
+                y2 = _mm512_fnmadd_pd(c, _mm512_loadu_pd(x + 16), y2);
+                y3 = _mm512_fnmadd_pd(c, _mm512_loadu_pd(x + 24), y3);
+            }
+            _mm512_storeu_pd(y + i, y0);
+            _mm512_storeu_pd(y + i + 8, y1);
+            _mm512_storeu_pd(y + i + 16, y2);
+            _mm512_storeu_pd(y + i + 24, y3);
+        }
+        // the rest with masked loads, 8 at a time
+        for (; i < n; i += 8)
+        {
+            __mmask8 mask = n - i >= 8 ? __mmask8(0xff) : __mmask8((1u << (n - i)) - 1);
+            __m512d y0 = _mm512_maskz_loadu_pd(mask, y + i);
+            for (std::size_t k = 0; k < count; k++)
+                y0 = _mm512_fnmadd_pd(_mm512_set1_pd(coefs[k]),
+                                      _mm512_maskz_loadu_pd(mask, rows[k] + i), y0);
+            _mm512_mask_storeu_pd(y + i, mask, y0);
+        }
+    }
+
+    __attribute__((target("avx512f"))) double dot_avx512(std::size_t n, const double* x,
+                                                         const double* y)
+    {
+        __m512d s0 = _mm512_setzero_pd();
+        __m512d s1 = _mm512_setzero_pd();
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            s0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i), s0);
+            s1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i + 8), _mm512_loadu_pd(y + i + 8), s1);
+        }
+        for (; i < n; i += 8)
+        {
+            __mmask8 mask = n - i >= 8 ? __mmask8(0xff) : __mmask8((1u << (n - i)) - 1);
+            s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, x + i),
+                                 _mm512_maskz_loadu_pd(mask, y + i), s0);
+        }
+        return hsum512(_mm512_add_pd(s0, s1));
+    }
+
+    __attribute__((target("avx512f"))) void dot4_avx512(std::size_t n, const double* x,
+                                                        const double* const* y, double* out)
+    {
+        __m512d s0 = _mm512_setzero_pd();
+        __m512d s1 = _mm512_setzero_pd();
+        __m512d s2 = _mm512_setzero_pd();
+        __m512d s3 = _mm512_setzero_pd();
+        for (std::size_t i = 0; i < n; i += 8)
+        {
+            __mmask8 mask = n - i >= 8 ? __mmask8(0xff) : __mmask8((1u << (n - i)) - 1);
+            __m512d v = _mm512_maskz_loadu_pd(mask, x + i);
+            s0 = _mm512_fmadd_pd(v, _mm512_maskz_loadu_pd(mask, y[0] + i), s0);
+            s1 = _mm512_fmadd_pd(v, _mm512_maskz_loadu_pd(mask, y[1] + i), s1);
+            s2 = _mm512_fmadd_pd(v, _mm512_maskz_loadu_pd(mask, y[2] + i), s2);
+            s3 = _mm512_fmadd_pd(v, _mm512_maskz_loadu_pd(mask, y[3] + i), s3);
+        }
+        out[0] += hsum512(s0);
+        out[1] += hsum512(s1);
+        out[2] += hsum512(s2);
+        out[3] += hsum512(s3);
+    }
+#endif
+
+    const DenseKernels scalar_kernels = { "scalar", update_row_scalar, dot_scalar, dot4_scalar };
+#ifdef ADJACENT_X86_KERNELS
+    const DenseKernels avx2_kernels = { "avx2", update_row_avx2, dot_avx2, dot4_avx2 };
+    const DenseKernels avx512_kernels = { "avx512", update_row_avx512, dot_avx512, dot4_avx512 };
+#endif
+}
+
+const DenseKernels* find_dense_kernels(const std::string& isa)
+{
+    if (isa == "scalar")
+        return &scalar_kernels;
+#ifdef ADJACENT_X86_KERNELS
+    __builtin_cpu_init();
+    if (isa == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return &avx2_kernels;
+    if (isa == "avx512" && __builtin_cpu_supports("avx512f"))
+        return &avx512_kernels;
+#endif
+    return nullptr;
+}
+
+const DenseKernels& dense_kernels()
+{
+    static const DenseKernels& best = [] () -> const DenseKernels& {
+        for (const char* isa : { "avx512", "avx2" })
+        {
+            if (const DenseKernels* kernels = find_dense_kernels(isa))
+                return *kernels;
+        }
+        return scalar_kernels;
+    }();
+    return best;
+}
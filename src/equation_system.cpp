@@ -1,5 +1,10 @@
 #include <vector>
+#include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <cmath>
+#include <limits>
 
 #include <xtensor/xtensor.hpp>
 #include <xtensor/xio.hpp>
@@ -10,20 +15,54 @@
 
 constexpr bool DEBUG = false;
 
+namespace
+{
+    inline void hash_combine(std::size_t& seed, std::size_t h)
+    {
+        seed ^= h + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+    }
+
+    // power of two nearest to 1 / magnitude, scaling by it is exact
+    double power_of_two_scale(double magnitude)
+    {
+        if (magnitude == 0.0 || !std::isfinite(magnitude))
+            return 1.0;
+        int exponent;
+        std::frexp(magnitude, &exponent);
+        return std::ldexp(1.0, 1 - exponent);
+    }
+
+    void collect_params(const std::shared_ptr<Expr>& e, std::unordered_set<const Expr*>& visited,
+                        std::vector<std::shared_ptr<Param<double>>>& params)
+    {
+        if (!visited.insert(e.get()).second)
+            return;
+        if (e->op == Op::ParamOp)
+        {
+            params.push_back(e->param);
+            return;
+        }
+        if (e->a != nullptr)
+            collect_params(e->a, visited, params);
+        if (e->b != nullptr)
+            collect_params(e->b, visited, params);
+    }
+}
+
 void EquationSystem::add_equation(const std::shared_ptr<Expr>& eq)
 {
     if (DEBUG)
         std::cout << "Adding equation: " << eq->to_string() << std::endl;
+    source_equation_index.emplace(eq.get(), source_equations.size());
     source_equations.push_back(eq);
     is_dirty = true;
 }
 
 void EquationSystem::add_equation(const ExpVector& v)
 {
-    source_equations.push_back(v.x);
-    source_equations.push_back(v.y);
-    source_equations.push_back(v.z);
-    is_dirty = true;
+    add_equation(v.x);
+    add_equation(v.y);
+    add_equation(v.z);
 }
 
 void EquationSystem::add_equations(const std::vector<ExprPtr>& eq)
@@ -34,13 +73,30 @@ void EquationSystem::add_equations(const std::vector<ExprPtr>& eq)
 
 void EquationSystem::remove_equation(const std::shared_ptr<Expr>& eq)
 {
-    auto it = std::find(source_equations.begin(), source_equations.end(), eq);
-    if (it == source_equations.end())
+    auto it = source_equation_index.find(eq.get());
+    if (it == source_equation_index.end())
     {
         throw std::runtime_error(
             "Could not remove equation, it doesn't exist in source_equations vector.");
     }
-    source_equations.erase(it);
+    std::size_t i = it->second;
+    source_equation_index.erase(it);
+    std::size_t last = source_equations.size() - 1;
+    if (i != last)
+    {
+        // the entry of the moved equation that points at the last position
+        auto range = source_equation_index.equal_range(source_equations[last].get());
+        for (auto moved = range.first; moved != range.second; ++moved)
+        {
+            if (moved->second == last)
+            {
+                moved->second = i;
+                break;
+            }
+        }
+        source_equations[i] = std::move(source_equations[last]);
+    }
+    source_equations.pop_back();
     is_dirty = true;
 }
 
@@ -48,10 +104,8 @@ void EquationSystem::add_parameter(const std::shared_ptr<Param<double>>& p)
 {
     if (DEBUG)
         std::cout << "Adding Parameter: " << p->to_string() << std::endl;
-    if (std::find(parameters.begin(), parameters.end(), p) != parameters.end())
-    {
+    if (!parameter_index.emplace(p.get(), parameters.size()).second)
         return;
-    }
     parameters.push_back(p);
     is_dirty = true;
 }
@@ -66,30 +120,55 @@ void EquationSystem::remove_parameter(const std::shared_ptr<Param<double>>& p)
 {
     if (DEBUG)
         std::cout << "Removing Parameter " << p->to_string() << std::endl;
-    auto it = std::find(parameters.begin(), parameters.end(), p);
-    if (it == parameters.end())
+    auto it = parameter_index.find(p.get());
+    if (it == parameter_index.end())
     {
         throw std::runtime_error(
             "Could not remove parameter, it doesn't exist in parameters vector.");
     }
+    std::size_t i = it->second;
+    parameter_index.erase(it);
+    std::size_t last = parameters.size() - 1;
+    if (i != last)
+    {
+        parameter_index[parameters[last].get()] = i;
+        parameters[i] = std::move(parameters[last]);
+    }
+    parameters.pop_back();
+    is_dirty = true;
+}
+
+bool EquationSystem::is_parallel() const
+{
+    return thread_pool != nullptr && thread_pool->size() > 1
+           && jacobian_pattern.cols.size() >= parallel_threshold;
 }
 
+// evaluation only reads params and expression nodes, so rows can be split across threads
 void EquationSystem::eval(xt::xtensor<double, 1>& B, bool clear_drag)
 {
     B.resize({ equations.size() });
-    for (int i = 0; i < equations.size(); i++)
-    {
-        if (clear_drag && equations[i]->is_drag())
+    auto eval_rows = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++)
         {
-            B(i) = 0.0;
-            continue;
+            if (clear_drag && equations[i]->is_drag())
+            {
+                B(i) = 0.0;
+                continue;
+            }
+            B(i) = equations[i]->eval();
         }
-        B(i) = equations[i]->eval();
-    }
+    };
+    if (is_parallel())
+        thread_pool->parallel_for(equations.size(), parallel_grain, eval_rows);
+    else
+        eval_rows(0, equations.size());
 }
 
-bool EquationSystem::is_converged(bool check_drag, bool print_non_converged /* = false*/)
+bool EquationSystem::is_converged(bool check_drag,
+                                  std::vector<std::string>* not_converged /* = nullptr*/)
 {
+    bool converged = true;
     for (int i = 0; i < equations.size(); i++)
     {
         if (!check_drag && equations[i]->is_drag())
@@ -97,34 +176,41 @@ bool EquationSystem::is_converged(bool check_drag, bool print_non_converged /* =
             continue;
         }
 
-        if (std::abs(B(i)) < GaussianMethod::epsilon)
+        if (std::abs(B(i)) < residual_tolerance(i))
             continue;
 
-        if (print_non_converged)
-        {
-            std::cout << "Not converged: " + equations[i]->to_string() << "\n";
-            continue;
-            // continue; ???
-        }
-        return false;
+        if (not_converged == nullptr)
+            return false;
+        not_converged->push_back(equations[i]->to_string());
+        converged = false;
     }
-    return true;
+    return converged;
+}
+
+double EquationSystem::residual_tolerance(std::size_t i) const
+{
+    if (!equilibrate)
+        return GaussianMethod::epsilon;
+    // a residual can't be computed more accurately than it moves when its params are off by
+    // a relative epsilon. Until the Jacobian is evaluated the scale is 0 and the test absolute.
+    return GaussianMethod::epsilon * std::max(1.0, residual_scale[i]);
+}
+
+void EquationSystem::store_param_magnitudes()
+{
+    param_magnitude.resize(current_params.size());
+    for (std::size_t c = 0; c < current_params.size(); c++)
+        param_magnitude[c] = std::abs(current_params[c]->value());
 }
 
 void EquationSystem::store_params()
 {
-    for (std::size_t i = 0; i < parameters.size(); i++)
-    {
-        old_param_value[i] = parameters[i]->value();
-    }
+    param_store.save(old_param_value.data());
 }
 
 void EquationSystem::revert_params()
 {
-    for (std::size_t i = 0; i < parameters.size(); i++)
-    {
-        parameters[i]->set_value(old_param_value[i]);
-    }
+    param_store.restore(old_param_value.data());
 }
 
 xt::xtensor<std::shared_ptr<Expr>, 2> EquationSystem::write_jacobian(
@@ -161,25 +247,32 @@ bool EquationSystem::has_dragged()
     return std::any_of(equations.begin(), equations.end(), [](auto& e) { return e->is_drag(); });
 }
 
+// A has to be zero outside of jacobian_pattern, only the non-zeros of J are evaluated
 void EquationSystem::eval_jacobian(const xt::xtensor<expr_ptr, 2>& J, xt::xtensor<double, 2>& A,
                                    bool clear_drag)
 {
     update_dirty();
-    for (std::size_t r = 0; r < J.shape(0); r++)
-    {
-        if (clear_drag && equations[r]->is_drag())
+    const auto& row_start = jacobian_pattern.row_start;
+    const auto& cols = jacobian_pattern.cols;
+    store_param_magnitudes();
+    auto eval_rows = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t r = begin; r < end; r++)
         {
-            for (std::size_t c = 0; c < J.shape(1); c++)
+            bool clear = clear_drag && equations[r]->is_drag();
+            double scale = 0.0;
+            for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
             {
-                A(r, c) = 0.0;
+                std::size_t c = cols[k];
+                A(r, c) = clear ? 0.0 : J(r, c)->eval();
+                scale += std::abs(A(r, c)) * param_magnitude[c];
             }
-            continue;
+            residual_scale[r] = scale;
         }
-        for (std::size_t c = 0; c < J.shape(1); c++)
-        {
-            A(r, c) = J(r, c)->eval();
-        }
-    }
+    };
+    if (is_parallel())
+        thread_pool->parallel_for(J.shape(0), parallel_grain, eval_rows);
+    else
+        eval_rows(0, J.shape(0));
 }
 
 void EquationSystem::solve_least_squares(const xt::xtensor<double, 2>& A,
@@ -189,59 +282,530 @@ void EquationSystem::solve_least_squares(const xt::xtensor<double, 2>& A,
     std::size_t rows = A.shape(0);
     std::size_t cols = A.shape(1);
 
+    // solved as (Dr A Dc) Y = Dr B with X = Dc Y, so the pivots GaussianMethod compares
+    // against its fixed epsilon are of order one whatever units the equations are in.
+    // Dc changes which of the solutions of an under-determined system has the minimum norm,
+    // so the columns are only scaled when there are at least as many rows.
+    row_scale.assign(rows, 1.0);
+    col_scale.assign(cols, 1.0);
+    if (equilibrate)
+    {
+        for (std::size_t r = 0; r < rows; r++)
+        {
+            double max = 0.0;
+            for (std::size_t c = 0; c < cols; c++)
+                max = std::max(max, std::abs(A(r, c)));
+            row_scale[r] = power_of_two_scale(max);
+        }
+        for (std::size_t c = 0; rows >= cols && c < cols; c++)
+        {
+            double max = 0.0;
+            for (std::size_t r = 0; r < rows; r++)
+                max = std::max(max, std::abs(A(r, c)) * row_scale[r]);
+            col_scale[c] = power_of_two_scale(max);
+        }
+    }
+
+    dense_backend->normal_matrix(A, row_scale, col_scale, AAT);
+
+    // AAT is formed again on every call, so it can be eliminated in place
     for (std::size_t r = 0; r < rows; r++)
+        scaled_B(r) = B(r) * row_scale[r];
+    if (!mixed_precision || !solve_mixed_precision())
+        dense_backend->solve_normal(AAT, scaled_B, Z);
+
+    for (int c = 0; c < cols; c++)
     {
-        // only up to `rows`?
-        for (std::size_t c = 0; c < rows; c++)
+        double sum = 0.0;
+        for (int r = 0; r < rows; r++)
         {
-            double sum = 0.0;
-            for (std::size_t i = 0; i < cols; i++)
+            sum += Z(r) * row_scale[r] * A(r, c);
+        }
+        X(c) = sum * col_scale[c] * col_scale[c];
+    }
+}
+
+// Z from a single precision factorization of AAT, refined with residuals computed in double
+// until it is as accurate as the double elimination would be. AAT and scaled_B are left intact
+// for that elimination when the refinement doesn't converge (AAT too badly conditioned).
+bool EquationSystem::solve_mixed_precision()
+{
+    std::size_t n = AAT.shape(0);
+    single_normal.factorize(AAT);
+    single_normal.solve(scaled_B, Z);
+
+    double b_norm = 0.0;
+    for (std::size_t r = 0; r < n; r++)
+        b_norm += scaled_B(r) * scaled_B(r);
+    double limit = mixed_precision_tolerance * mixed_precision_tolerance * b_norm;
+    for (int it = 0;; it++)
+    {
+        double r_norm = 0.0;
+        for (std::size_t r = 0; r < n; r++)
+        {
+            double sum = scaled_B(r);
+            for (std::size_t c = 0; c < n; c++)
+                sum -= AAT(r, c) * Z(c);
+            refine_residual(r) = sum;
+            r_norm += sum * sum;
+        }
+        if (r_norm <= limit)
+        {
+            if (report_sink)
+                report.single_precision_steps++;
+            return true;
+        }
+        if (it >= mixed_precision_refinements || !std::isfinite(r_norm))
+            break;
+        single_normal.solve(refine_residual, refine_correction);
+        for (std::size_t r = 0; r < n; r++)
+            Z(r) += refine_correction(r);
+    }
+    if (report_sink)
+        report.double_precision_fallbacks++;
+    return false;
+}
+
+// only the derivatives by params an equation references are taken, so building J is
+// proportional to its non-zeros instead of rows * cols
+void EquationSystem::write_sparse_jacobian()
+{
+    jacobian_pattern.clear(current_params.size());
+    sparse_jacobian.clear();
+    std::vector<std::shared_ptr<Param<double>>> referenced;
+    std::unordered_set<const Expr*> visited;
+    std::vector<std::size_t> cols;
+    for (const auto& eq : equations)
+    {
+        referenced.clear();
+        visited.clear();
+        collect_params(eq, visited, referenced);
+        cols.clear();
+        // the unknowns are the first params of the store
+        for (const auto& p : referenced)
+        {
+            std::size_t c = param_store.find(p.get());
+            if (c < current_params.size())
+                cols.push_back(c);
+        }
+        std::sort(cols.begin(), cols.end());
+        for (std::size_t c : cols)
+        {
+            auto d = eq->derivative(current_params[c]);
+            if (d->is_zero_const())
+                continue;
+            jacobian_pattern.cols.push_back(c);
+            sparse_jacobian.push_back(d);
+        }
+        jacobian_pattern.row_start.push_back(jacobian_pattern.cols.size());
+    }
+}
+
+void EquationSystem::eval_sparse_jacobian(bool clear_drag)
+{
+    update_dirty();
+    const auto& row_start = jacobian_pattern.row_start;
+    const auto& cols = jacobian_pattern.cols;
+    store_param_magnitudes();
+    auto eval_rows = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t r = begin; r < end; r++)
+        {
+            bool clear = clear_drag && equations[r]->is_drag();
+            double scale = 0.0;
+            for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
+            {
+                sparse_values[k] = clear ? 0.0 : sparse_jacobian[k]->eval();
+                scale += std::abs(sparse_values[k]) * param_magnitude[cols[k]];
+            }
+            residual_scale[r] = scale;
+        }
+    };
+    if (is_parallel())
+        thread_pool->parallel_for(equations.size(), parallel_grain, eval_rows);
+    else
+        eval_rows(0, equations.size());
+}
+
+// Paige & Saunders' LSQR started from X = 0, which converges to the minimum norm solution.
+// Scaling the rows to unit length is a Jacobi preconditioner that leaves that solution of
+// a consistent system unchanged.
+void EquationSystem::solve_lsqr(const xt::xtensor<double, 1>& B, xt::xtensor<double, 1>& X)
+{
+    const auto& row_start = jacobian_pattern.row_start;
+    const auto& cols = jacobian_pattern.cols;
+    std::size_t rows = equations.size();
+    std::size_t n = current_params.size();
+
+    row_scale.resize(rows);
+    lsqr_u.resize(rows);
+    lsqr_v.resize(n);
+    lsqr_w.resize(n);
+    auto& u = lsqr_u;
+    auto& v = lsqr_v;
+    auto& w = lsqr_w;
+
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        double sum = 0.0;
+        for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
+            sum += sparse_values[k] * sparse_values[k];
+        row_scale[r] = sum > 0.0 ? 1.0 / std::sqrt(sum) : 0.0;
+    }
+    // as in solve_least_squares the columns are only scaled if that can't change the result
+    col_scale.assign(n, 0.0);
+    if (equilibrate && rows >= n)
+    {
+        for (std::size_t r = 0; r < rows; r++)
+        {
+            for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
             {
-                if (A(c, i) == 0 || A(r, i) == 0)
-                    continue;
-                sum += A(r, i) * A(c, i);
+                double& max = col_scale[cols[k]];
+                max = std::max(max, std::abs(sparse_values[k]) * row_scale[r]);
             }
-            AAT(r, c) = sum;
         }
     }
+    for (double& scale : col_scale)
+        scale = power_of_two_scale(scale);
+    double a_norm = 0.0;
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
+        {
+            double value = row_scale[r] * sparse_values[k] * col_scale[cols[k]];
+            a_norm += value * value;
+        }
+    }
+    a_norm = std::sqrt(a_norm);
 
-    GaussianMethod::solve(AAT, B, Z);
+    auto norm = [](const std::vector<double>& x) {
+        double sum = 0.0;
+        for (double e : x)
+            sum += e * e;
+        return std::sqrt(sum);
+    };
+    auto scale = [](std::vector<double>& x, double f) {
+        for (double& e : x)
+            e *= f;
+    };
+    // u = D A v - alpha u
+    auto apply_a = [&](double alpha) {
+        for (std::size_t r = 0; r < rows; r++)
+        {
+            double sum = 0.0;
+            for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
+                sum += sparse_values[k] * col_scale[cols[k]] * v[cols[k]];
+            u[r] = row_scale[r] * sum - alpha * u[r];
+        }
+    };
+    // v = A^T D u - beta v
+    auto apply_at = [&](double beta) {
+        scale(v, -beta);
+        for (std::size_t r = 0; r < rows; r++)
+        {
+            double ur = row_scale[r] * u[r];
+            for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
+                v[cols[k]] += sparse_values[k] * col_scale[cols[k]] * ur;
+        }
+    };
 
-    for (int c = 0; c < cols; c++)
+    X.fill(0.0);
+    for (std::size_t r = 0; r < rows; r++)
+        u[r] = row_scale[r] * B(r);
+    double beta = norm(u);
+    if (beta == 0.0)
+        return;
+    scale(u, 1.0 / beta);
+    std::fill(v.begin(), v.end(), 0.0);
+    apply_at(0.0);
+    double alpha = norm(v);
+    if (alpha == 0.0)
+        return;
+    scale(v, 1.0 / alpha);
+    w = v;
+
+    double b_norm = beta;
+    double phibar = beta;
+    double rhobar = alpha;
+    std::size_t max_iterations
+        = lsqr_max_iterations > 0 ? lsqr_max_iterations : 2 * std::min(rows, n) + 10;
+    for (std::size_t it = 0; it < max_iterations; it++)
     {
+        apply_a(alpha);
+        beta = norm(u);
+        if (beta > 0.0)
+            scale(u, 1.0 / beta);
+        apply_at(beta);
+        alpha = norm(v);
+        if (alpha > 0.0)
+            scale(v, 1.0 / alpha);
+
+        double rho = std::hypot(rhobar, beta);
+        double c = rhobar / rho;
+        double s = beta / rho;
+        double theta = s * alpha;
+        rhobar = -c * alpha;
+        double phi = c * phibar;
+        phibar = s * phibar;
+
+        for (std::size_t i = 0; i < n; i++)
+        {
+            X(i) += phi / rho * w[i];
+            w[i] = v[i] - theta / rho * w[i];
+        }
+
+        // |r| for consistent systems, |A^T r| = phibar * alpha * |c| for inconsistent ones
+        if (phibar <= lsqr_tolerance * b_norm)
+            break;
+        if (phibar * alpha * std::abs(c) <= lsqr_tolerance * a_norm * phibar)
+            break;
+        if (alpha == 0.0)
+            break;
+    }
+    for (std::size_t i = 0; i < n; i++)
+        X(i) *= col_scale[i];
+}
+
+void EquationSystem::form_normal_matrix(const xt::xtensor<double, 2>& A,
+                                        xt::xtensor<double, 2>& AAT)
+{
+    // every pair of rows sharing a column
+    const auto& col_start = pattern_col_start;
+    const auto& col_rows = pattern_col_rows;
+    AAT.fill(0.0);
+    for (std::size_t c = 0; c < A.shape(1); c++)
+    {
+        for (std::size_t i = col_start[c]; i < col_start[c + 1]; i++)
+        {
+            std::size_t r = col_rows[i];
+            double v = A(r, c);
+            if (v == 0.0)
+                continue;
+            for (std::size_t j = col_start[c]; j < col_start[c + 1]; j++)
+                AAT(r, col_rows[j]) += v * A(col_rows[j], c);
+        }
+    }
+}
+
+void EquationSystem::kept_step(bool drag_rows)
+{
+    auto& kept_factor = kept[drag_rows];
+    double residual = 0.0;
+    for (std::size_t i = 0; i < equations.size(); i++)
+        residual += B(i) * B(i);
+
+    // a chord step that didn't contract enough means the Jacobian drifted too far
+    bool slow = kept_factor.residual >= 0.0
+                && residual > kept_contraction * kept_contraction * kept_factor.residual;
+    if (!kept_factor.valid || slow)
+    {
+        eval_jacobian(J, A, !drag_rows);
+        form_normal_matrix(A, AAT);
+        kept_factor.normal.factorize(AAT);
+        if (kept_factor.A.shape() == A.shape())
+            std::copy(A.begin(), A.end(), kept_factor.A.begin());
+        else
+            kept_factor.A = A;
+        kept_factor.valid = true;
+    }
+    kept_factor.residual = residual;
+
+    kept_factor.normal.solve(B, Z);
+    const auto& row_start = jacobian_pattern.row_start;
+    const auto& cols = jacobian_pattern.cols;
+    X.fill(0.0);
+    for (std::size_t r = 0; r < equations.size(); r++)
+    {
+        for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
+            X(cols[k]) += Z(r) * kept_factor.A(r, cols[k]);
+    }
+}
+
+double EquationSystem::step_slope(bool drag_rows)
+{
+    const auto& row_start = jacobian_pattern.row_start;
+    const auto& cols = jacobian_pattern.cols;
+    const auto& kept_A = kept[drag_rows].A;
+    double slope = 0.0;
+    for (std::size_t r = 0; r < equations.size(); r++)
+    {
+        if (B(r) == 0.0)
+            continue;
         double sum = 0.0;
-        for (int r = 0; r < rows; r++)
+        for (std::size_t k = row_start[r]; k < row_start[r + 1]; k++)
+        {
+            std::size_t c = cols[k];
+            if (sparse)
+                sum += sparse_values[k] * X(c);
+            else if (keep_factorization)
+                sum += kept_A(r, c) * X(c);
+            else
+                sum += A(r, c) * X(c);
+        }
+        slope += B(r) * sum;
+    }
+    return slope;
+}
+
+bool EquationSystem::take_step(bool clear_drag, double& step_scale)
+{
+    double residual = 0.0;
+    for (std::size_t i = 0; i < equations.size(); i++)
+        residual += B(i) * B(i);
+    // non-monotone: compared against the largest of the last few residuals, so a Newton step
+    // that overshoots once on the way into the quadratic region isn't cut short
+    residual_history.push_back(residual);
+    std::size_t memory = std::max(1, line_search_memory);
+    std::size_t first = residual_history.size() > memory ? residual_history.size() - memory : 0;
+    double reference = *std::max_element(residual_history.begin() + first, residual_history.end());
+    // the full step reduces the linearized |f|^2 by 2 * slope at the start
+    double slope = step_slope(/*drag_rows*/ !clear_drag);
+    std::size_t n = current_params.size();
+    double* values = param_store.values();
+    std::copy(values, values + n, step_origin.begin());
+
+    double alpha = 1.0;
+    double best_alpha = 0.0;
+    double best_residual = std::numeric_limits<double>::infinity();
+    for (int k = 0;; k++)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            values[i] = step_origin(i) - alpha * X(i);
+        eval(trial_B, clear_drag);
+        double trial = 0.0;
+        for (std::size_t i = 0; i < equations.size(); i++)
+            trial += trial_B(i) * trial_B(i);
+
+        // not a descent direction (a stale chord step or no step at all), taken as is like
+        // without line search
+        if (!(slope > 0.0) || trial <= reference - 2.0 * armijo * alpha * slope)
         {
-            sum += Z(r) * A(r, c);
+            std::swap(B, trial_B);
+            step_scale = alpha;
+            return true;
         }
-        X(c) = sum;
+        if (trial < best_residual)
+        {
+            best_residual = trial;
+            best_alpha = alpha;
+        }
+        if (k >= max_backtracks)
+            break;
+        alpha *= 0.5;
     }
+
+    // the least bad of the tried steps, none if they all failed to evaluate
+    for (std::size_t i = 0; i < n; i++)
+        values[i] = step_origin(i) - best_alpha * X(i);
+    step_scale = best_alpha;
+    return false;
 }
 
 void EquationSystem::clear()
 {
     parameters.clear();
+    parameter_index.clear();
     current_params.clear();
     equations.clear();
     source_equations.clear();
+    source_equation_index.clear();
     is_dirty = true;
     update_dirty();
 }
 
+void EquationSystem::analyze_structure()
+{
+    update_dirty();
+    if (structure_analyzed)
+        return;
+    structural_matching.compute(jacobian_pattern);
+    structure_analyzed = true;
+}
+
+std::size_t EquationSystem::structural_rank()
+{
+    analyze_structure();
+    return structural_matching.size();
+}
+
+int EquationSystem::structural_dof()
+{
+    return int(current_params.size()) - int(structural_rank());
+}
+
+std::vector<std::shared_ptr<Expr>> EquationSystem::structurally_conflicting_equations()
+{
+    analyze_structure();
+    std::vector<std::shared_ptr<Expr>> res;
+    for (std::size_t r : structural_matching.overdetermined_rows(jacobian_pattern))
+        res.push_back(equation_sources[r]);
+    return res;
+}
+
 bool EquationSystem::test_rank(int& dof)
 {
+    update_dirty();
+    // sparse systems are too large for the dense QR, so only the structural rank is checked
+    // for them. It bounds the numeric rank from above, which makes their dof a lower bound.
+    if (sparse)
+    {
+        dof = structural_dof();
+        dof_is_lower_bound = true;
+        return structural_rank() == equations.size();
+    }
+
+    // the numeric rank even when the structural one is already deficient, which only says
+    // that the rank isn't full, not what the dof is
+    dof_is_lower_bound = false;
     eval_jacobian(J, A, false);
-    int rank = GaussianMethod::rank(A);
+    // rows of equations the last rank test already had, in the same columns and at the same
+    // values, are kept. Rows evaluated elsewhere would leave the kept basis stale. Params
+    // added since are columns after them.
+    bool same_values = rank_params.size() <= current_params.size();
+    for (std::size_t i = 0; same_values && i < rank_params.size(); i++)
+        same_values = rank_params[i] == current_params[i]
+                      && rank_values[i] == current_params[i]->value();
+    std::size_t kept_rows = 0;
+    if (same_values)
+    {
+        std::size_t n = std::min(rank_sources.size(), equation_sources.size());
+        while (kept_rows < n && rank_sources[kept_rows] == equation_sources[kept_rows])
+            kept_rows++;
+    }
+    rank_sources = equation_sources;
+    rank_params = current_params;
+    rank_values.resize(current_params.size());
+    for (std::size_t i = 0; i < current_params.size(); i++)
+        rank_values[i] = current_params[i]->value();
+    int rank = int(dense_backend->rank(A, kept_rows));
     dof = A.shape(1) - rank;
     return rank == A.shape(0);
 }
 
+std::vector<std::shared_ptr<Expr>> EquationSystem::find_dependent_equations()
+{
+    int dof;
+    std::vector<std::shared_ptr<Expr>> res;
+    if (test_rank(dof))
+        return res;
+    if (structural_rank() < equations.size())
+        return structurally_conflicting_equations();
+    // the dense backend didn't see a sparse system, its rows are from an older test
+    if (sparse)
+        return res;
+    for (std::size_t r : dense_backend->dependent_rows())
+        res.push_back(equation_sources[r]);
+    return res;
+}
+
 void EquationSystem::update_dirty()
 {
-    if (is_dirty)
+    // a cancelled rebuild leaves is_dirty set, so the next call starts over
+    auto stopped = [this] { return control != nullptr && control->should_stop(); };
+    if (is_dirty && !stopped())
     {
         // equations = source_equations.Select(e => e.DeepClone()).ToList();
         equations = source_equations;
+        equation_sources = source_equations;
         current_params = parameters;
         /*
         foreach(var e in equations) {
@@ -249,91 +813,516 @@ void EquationSystem::update_dirty()
         }*/
         // current_params = parameters.Where(p => equations.Any(e => e.IsDependOn(p))).ToList();
         subs = solve_by_substitution();
+        if (stopped())
+            return;
+
+        // unknowns first so that a step moves a prefix of the values
+        std::vector<std::shared_ptr<Param<double>>> store_order = current_params;
+        store_order.insert(store_order.end(), parameters.begin(), parameters.end());
+        param_store.assign(store_order);
+        substituted.clear();
+        for (const auto& p : parameters)
+        {
+            auto it = subs.find(p);
+            if (it != subs.end())
+                substituted.emplace_back(param_store.find(p.get()), it->second);
+        }
+
+        sparse = linear_solver == LINEAR_LSQR
+                 || (linear_solver == LINEAR_AUTO && current_params.size() >= lsqr_threshold);
+        if (sparse)
+        {
+            write_sparse_jacobian();
+            sparse_values.assign(sparse_jacobian.size(), 0.0);
+            J = xt::empty<std::shared_ptr<Expr>>({ std::size_t(0), std::size_t(0) });
+            A = xt::zeros<double>({ std::size_t(0), std::size_t(0) });
+            AAT = xt::empty<double>({ std::size_t(0), std::size_t(0) });
+        }
+        else
+        {
+            J = write_jacobian(equations, current_params);
+            jacobian_pattern.clear(current_params.size());
+            for (std::size_t r = 0; r < J.shape(0); r++)
+            {
+                for (std::size_t c = 0; c < J.shape(1); c++)
+                {
+                    if (!J(r, c)->is_zero_const())
+                        jacobian_pattern.cols.push_back(c);
+                }
+                jacobian_pattern.row_start.push_back(jacobian_pattern.cols.size());
+            }
+            sparse_jacobian.clear();
+            sparse_values.clear();
+            A = xt::zeros<double>(J.shape());
+            AAT = xt::empty<double>({ equations.size(), equations.size() });
+        }
+        structure_analyzed = false;
+        if (stopped())
+            return;
+
+        // rows touching each column
+        const auto& cols = jacobian_pattern.cols;
+        pattern_col_start.assign(current_params.size() + 1, 0);
+        for (std::size_t c : cols)
+            pattern_col_start[c + 1]++;
+        for (std::size_t c = 0; c < current_params.size(); c++)
+            pattern_col_start[c + 1] += pattern_col_start[c];
+        pattern_col_rows.resize(cols.size());
+        std::vector<std::size_t> fill(pattern_col_start.begin(), pattern_col_start.end() - 1);
+        for (std::size_t r = 0; r < equations.size(); r++)
+        {
+            for (std::size_t k = jacobian_pattern.row_start[r];
+                 k < jacobian_pattern.row_start[r + 1]; k++)
+                pattern_col_rows[fill[cols[k]]++] = r;
+        }
 
-        J = write_jacobian(equations, current_params);
-        A = xt::empty<double>(J.shape());
         B = xt::empty<double>({ equations.size() });
         X = xt::empty<double>({ current_params.size() });
-        Z = xt::empty<double>({ A.shape(0) });
-        AAT = xt::empty<double>({ A.shape(0), A.shape(0) });
-        old_param_value = xt::empty<double>({ parameters.size() });
+        Z = xt::empty<double>({ equations.size() });
+        scaled_B = xt::empty<double>({ equations.size() });
+        refine_residual = xt::empty<double>({ equations.size() });
+        refine_correction = xt::empty<double>({ equations.size() });
+        trial_B = xt::empty<double>({ equations.size() });
+        step_origin = xt::empty<double>({ current_params.size() });
+        old_param_value = xt::empty<double>({ param_store.size() });
+        best_param_value = xt::empty<double>({ current_params.size() });
+        kept[0].valid = false;
+        kept[1].valid = false;
+
+        structure_hash = 0;
+        for (const auto& e : source_equations)
+            hash_combine(structure_hash, std::hash<const Expr*>()(e.get()));
+        for (const auto& p : parameters)
+            hash_combine(structure_hash, std::hash<const Param<double>*>()(p.get()));
+
+        residual_scale.assign(equations.size(), 0.0);
+
+        std::vector<std::shared_ptr<Param<double>>> referenced;
+        std::unordered_set<const Expr*> visited;
+        for (const auto& e : source_equations)
+            collect_params(e, visited, referenced);
+        std::unordered_set<std::shared_ptr<Param<double>>> known(parameters.begin(),
+                                                                 parameters.end());
+        input_params.clear();
+        for (const auto& p : referenced)
+        {
+            if (known.insert(p).second)
+                input_params.push_back(p);
+        }
+        input_values.resize(input_params.size());
+
         is_dirty = false;
         dof_changed = true;
     }
 }
 
-void EquationSystem::back_substitution(
-    std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Param<double>>>& subs)
+void EquationSystem::back_substitution()
 {
-    if (subs.empty())
-        return;
-    for (std::size_t i = 0; i < parameters.size(); i++)
+    for (const auto& s : substituted)
+        param_store.set_value(s.first, s.second->eval());
+}
+
+namespace
+{
+    // An equation of the form `s0 * p0 + s1 * p1 + offset = 0` where p0, p1 are unknowns,
+    // s0, s1 are +1 / -1 and offset only consists of constants and params outside of the system.
+    struct OffsetForm
     {
-        auto& p = parameters[i];
-        if (subs.find(p) == subs.end())
-            continue;
-        p->set_value(subs[p]->value());
+        std::shared_ptr<Param<double>> params[2];
+        bool negated[2] = { false, false };
+        int count = 0;
+        std::shared_ptr<Expr> offset = zero;
+    };
+
+    bool collect_offset_form(
+        const std::shared_ptr<Expr>& e, bool negated,
+        const std::unordered_map<std::shared_ptr<Param<double>>, std::size_t>& unknowns,
+        OffsetForm& form)
+    {
+        switch (e->op)
+        {
+            case Op::Add:
+                return collect_offset_form(e->a, negated, unknowns, form)
+                       && collect_offset_form(e->b, negated, unknowns, form);
+            case Op::Sub:
+                return collect_offset_form(e->a, negated, unknowns, form)
+                       && collect_offset_form(e->b, !negated, unknowns, form);
+            case Op::Neg:
+                return collect_offset_form(e->a, !negated, unknowns, form);
+            case Op::Pos:
+                return collect_offset_form(e->a, negated, unknowns, form);
+            case Op::ParamOp:
+                if (unknowns.find(e->param) != unknowns.end())
+                {
+                    if (form.count == 2)
+                        return false;
+                    form.params[form.count] = e->param;
+                    form.negated[form.count] = negated;
+                    form.count++;
+                    return true;
+                }
+                // params outside of the system are constants
+                form.offset = negated ? form.offset - e : form.offset + e;
+                return true;
+            case Op::Const:
+                form.offset = negated ? form.offset - e : form.offset + e;
+                return true;
+            default:
+                return false;
+        }
     }
+
+    // Union-find where every element knows its offset to the parent:
+    // value(i) = value(parent[i]) + offset[i]. The extra last element is the ground (value 0),
+    // elements attached to it are fully determined by constants.
+    class OffsetUnionFind
+    {
+    public:
+        OffsetUnionFind(std::size_t n)
+            : parent(n + 1)
+            , offset(n + 1, zero)
+            , rank(n + 1, 0)
+            , pinned(n + 1, false)
+        {
+            for (std::size_t i = 0; i <= n; i++)
+                parent[i] = i;
+            pinned[n] = true;
+        }
+
+        std::size_t ground() const
+        {
+            return parent.size() - 1;
+        }
+
+        void pin(std::size_t i)
+        {
+            pinned[i] = true;
+        }
+
+        std::size_t find(std::size_t i)
+        {
+            std::size_t p = parent[i];
+            if (p == i)
+                return i;
+            std::size_t root = find(p);
+            if (p != root)
+            {
+                offset[i] = offset[i] + offset[p];
+                parent[i] = root;
+            }
+            return root;
+        }
+
+        const std::shared_ptr<Expr>& offset_to_root(std::size_t i)
+        {
+            find(i);
+            return offset[i];
+        }
+
+        // value(a) = value(b) + d, returns false if a and b are already related
+        // or both of their roots have to stay in the system
+        bool unite(std::size_t a, std::size_t b, const std::shared_ptr<Expr>& d)
+        {
+            std::size_t ra = find(a);
+            std::size_t rb = find(b);
+            if (ra == rb || (pinned[ra] && pinned[rb]))
+                return false;
+
+            // value(ra) + offset[a] = value(rb) + offset[b] + d
+            if (pinned[rb] || (!pinned[ra] && rank[ra] < rank[rb]))
+            {
+                attach(ra, rb, offset[b] + d - offset[a]);
+            }
+            else
+            {
+                attach(rb, ra, offset[a] - d - offset[b]);
+            }
+            return true;
+        }
+
+    private:
+        void attach(std::size_t child, std::size_t root, const std::shared_ptr<Expr>& d)
+        {
+            parent[child] = root;
+            offset[child] = d;
+            if (rank[child] == rank[root])
+                rank[root]++;
+        }
+
+        std::vector<std::size_t> parent;
+        std::vector<std::shared_ptr<Expr>> offset;
+        std::vector<int> rank;
+        std::vector<bool> pinned;
+    };
 }
 
-std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Param<double>>>
+std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Expr>>
 EquationSystem::solve_by_substitution()
 {
-    std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Param<double>>> subs;
+    std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Expr>> subs;
     if (DEBUG)
         std::cout << "Solving by substitution" << std::endl;
+
+    std::unordered_map<std::shared_ptr<Param<double>>, std::size_t> unknowns;
+    unknowns.reserve(current_params.size());
+    for (std::size_t i = 0; i < current_params.size(); i++)
+        unknowns.emplace(current_params[i], i);
+
+    OffsetUnionFind uf(current_params.size());
+    for (std::size_t i = 0; i < current_params.size(); i++)
+    {
+        if (!current_params[i]->m_reduceable)
+            uf.pin(i);
+    }
+
+    // equations that relate two unknowns (or an unknown and a constant) by an offset
+    // are consumed by the union-find, all others stay in the system
+    std::vector<bool> consumed(equations.size(), false);
+    std::size_t n_consumed = 0;
     for (std::size_t i = 0; i < equations.size(); i++)
     {
-        auto& eq = equations[i];
-        if (!eq->is_substitution_form())
-        {
+        OffsetForm form;
+        if (!collect_offset_form(equations[i], false, unknowns, form) || form.count == 0)
             continue;
-        }
-        auto a = eq->get_substitution_param_a();
-        auto b = eq->get_substitution_param_b();
-        if (std::abs(a->value() - b->value()) > GaussianMethod::epsilon)
+        // only relations that already hold, substituting the others would move the params
+        // onto each other before Newton gets to weigh them against the rest of the system
+        if (std::abs(equations[i]->eval()) > GaussianMethod::epsilon)
             continue;
-        // check if b in current params
-        if (std::find(current_params.begin(), current_params.end(), b) != current_params.end())
+
+        bool united = false;
+        if (form.count == 1)
+        {
+            // p = -offset, or p = offset if p is negated
+            auto value = form.negated[0] ? form.offset : -form.offset;
+            united = uf.unite(unknowns[form.params[0]], uf.ground(), value);
+        }
+        else if (form.negated[0] != form.negated[1])
         {
-            // check if pointer swap is enough?!
-            std::swap(a, b);
+            // a - b + offset = 0  =>  a = b - offset
+            std::size_t a = unknowns[form.params[form.negated[0] ? 1 : 0]];
+            std::size_t b = unknowns[form.params[form.negated[0] ? 0 : 1]];
+            united = uf.unite(a, b, -form.offset);
         }
-        // TODO: Check errors
-        // if(!parameters.Contains(b)) {
-        //  continue;
-        //}
 
-        for (auto& kv : subs)
+        if (united)
         {
-            if (subs[kv.first] == b)
-            {
-                subs[kv.first] = a;
-            }
+            consumed[i] = true;
+            n_consumed++;
         }
-        subs[b] = a;
+    }
+
+    if (n_consumed == 0)
+        return subs;
 
-        equations.erase(equations.begin() + i);
-        i--;
-        current_params.erase(std::find(current_params.begin(), current_params.end(), b));
-        for (std::size_t j = 0; j < equations.size(); j++)
+    std::vector<std::shared_ptr<Param<double>>> remaining_params;
+    remaining_params.reserve(current_params.size());
+    for (std::size_t i = 0; i < current_params.size(); i++)
+    {
+        std::size_t root = uf.find(i);
+        if (root == i)
         {
-            equations[j]->substitute(b, a);
+            remaining_params.push_back(current_params[i]);
+            continue;
         }
+        const auto& offset = uf.offset_to_root(i);
+        subs[current_params[i]]
+            = root == uf.ground() ? offset : current_params[root]->expr() + offset;
+
+        if (DEBUG)
+            std::cout << "Substituting " << current_params[i]->to_string() << " with "
+                      << subs[current_params[i]]->to_string() << std::endl;
     }
+
+    std::vector<std::shared_ptr<Expr>> remaining_equations;
+    std::vector<std::shared_ptr<Expr>> remaining_sources;
+    remaining_equations.reserve(equations.size() - n_consumed);
+    remaining_sources.reserve(equations.size() - n_consumed);
+    for (std::size_t i = 0; i < equations.size(); i++)
+    {
+        if (consumed[i])
+            continue;
+        remaining_equations.push_back(equations[i]->substituted(subs));
+        remaining_sources.push_back(equation_sources[i]);
+    }
+
+    equations = std::move(remaining_equations);
+    equation_sources = std::move(remaining_sources);
+    current_params = std::move(remaining_params);
     return subs;
 }
 
+std::size_t EquationSystem::configuration_key()
+{
+    std::size_t key = structure_hash;
+    for (std::size_t i = 0; i < input_params.size(); i++)
+    {
+        input_values[i] = input_params[i]->value();
+        hash_combine(key, std::hash<double>()(input_values[i]));
+    }
+    return key;
+}
+
+bool EquationSystem::warm_start(std::size_t key)
+{
+    auto it = warm_start_index.find(key);
+    if (it == warm_start_index.end())
+        return false;
+    const auto& entry = *it->second;
+    if (entry.structure_hash != structure_hash || entry.inputs != input_values
+        || entry.values.size() != parameters.size())
+        return false;
+
+    for (std::size_t i = 0; i < parameters.size(); i++)
+        parameters[i]->set_value(entry.values[i]);
+    warm_starts.splice(warm_starts.begin(), warm_starts, it->second);
+    return true;
+}
+
+void EquationSystem::remember_solution(std::size_t key)
+{
+    if (warm_start_capacity == 0)
+        return;
+
+    auto it = warm_start_index.find(key);
+    if (it != warm_start_index.end())
+    {
+        warm_starts.splice(warm_starts.begin(), warm_starts, it->second);
+    }
+    else
+    {
+        warm_starts.emplace_front();
+        warm_start_index[key] = warm_starts.begin();
+        while (warm_starts.size() > warm_start_capacity)
+        {
+            warm_start_index.erase(warm_starts.back().key);
+            warm_starts.pop_back();
+        }
+    }
+
+    auto& entry = warm_starts.front();
+    entry.key = key;
+    entry.structure_hash = structure_hash;
+    entry.inputs = input_values;
+    entry.values.resize(parameters.size());
+    for (std::size_t i = 0; i < parameters.size(); i++)
+        entry.values[i] = parameters[i]->value();
+}
+
+void EquationSystem::clear_warm_starts()
+{
+    warm_starts.clear();
+    warm_start_index.clear();
+}
+
 SolveResult EquationSystem::solve()
 {
+    using clock = std::chrono::steady_clock;
+    bool reporting = static_cast<bool>(report_sink);
+    clock::time_point start, t;
+    auto seconds_since = [](clock::time_point from) {
+        return std::chrono::duration<double>(clock::now() - from).count();
+    };
+    if (reporting)
+    {
+        report.clear();
+        report.iterations.reserve(max_steps + 2);
+        start = clock::now();
+    }
+    residual_history.reserve(max_steps + 2);
+
+    auto finish = [&](SolveResult result) {
+        if (reporting)
+        {
+            report.result = result;
+            report.total_seconds = seconds_since(start);
+            report_sink(report);
+        }
+        return result;
+    };
+
     dof_changed = false;
     update_dirty();
+    if (is_dirty)
+        return finish(SolveResult::CANCELLED);
+    // the params live in param_store until the solve returns
+    ParamStoreBinding binding(param_store);
+    double* values = param_store.values();
     store_params();
+    if (reporting)
+    {
+        report.update_dirty_seconds = seconds_since(start);
+        report.equations = equations.size();
+        report.unknowns = current_params.size();
+        report.substitutions = subs.size();
+    }
+
+    // only warm start when the configuration changed since the last solve (e.g. a dimension
+    // was toggled back or an edit undone), otherwise params moved by the user would snap back
+    bool use_cache = warm_start_capacity > 0 && !has_dragged();
+    std::size_t key = use_cache ? configuration_key() : 0;
+    if (use_cache && key != last_configuration_key)
+    {
+        eval(B, /*clear_drag*/ false);
+        if (!is_converged(/*check_drag*/ false))
+            warm_start(key);
+    }
+    last_configuration_key = key;
+
+    kept[0].residual = -1.0;
+    kept[1].residual = -1.0;
+
     int steps = 0;
+    bool cancelled = false;
+    double best_residual = -1.0;
+    // the line search leaves the residual at the accepted step in B
+    bool residual_ready = false;
+    bool residual_clear_drag = false;
+    bool dragging = has_dragged();
+    double progress_residual = -1.0;
+    int stalled_steps = 0;
     do
     {
+        if (control != nullptr && control->should_stop())
+        {
+            cancelled = true;
+            break;
+        }
         bool is_drag_step = steps <= drag_steps;
-        eval(B, /*clear_drag*/ !is_drag_step);
+        // residuals with and without the drag rows aren't comparable
+        if (steps == 0 || (dragging && steps == drag_steps + 1))
+        {
+            residual_history.clear();
+            progress_residual = -1.0;
+            stalled_steps = 0;
+        }
+        if (reporting)
+            t = clock::now();
+        if (!residual_ready || residual_clear_drag != !is_drag_step)
+            eval(B, /*clear_drag*/ !is_drag_step);
+        residual_ready = false;
+        if (reporting)
+        {
+            report.eval_seconds += seconds_since(t);
+            double norm = 0.0;
+            for (std::size_t i = 0; i < equations.size(); i++)
+                norm += B(i) * B(i);
+            report.iterations.push_back({ std::sqrt(norm), 0.0, 1.0 });
+        }
+
+        if (control != nullptr)
+        {
+            double residual = 0.0;
+            for (std::size_t i = 0; i < equations.size(); i++)
+            {
+                if (!equations[i]->is_drag())
+                    residual += B(i) * B(i);
+            }
+            if (best_residual < 0.0 || residual < best_residual)
+            {
+                best_residual = residual;
+                std::copy(values, values + current_params.size(), best_param_value.begin());
+            }
+        }
         /*
         if(steps > 0) {
             BackSubstitution(subs);
@@ -344,14 +1333,10 @@ SolveResult EquationSystem::solve()
         if (is_converged(is_drag_step))
         {
             if (steps > 0)
-            {
                 dof_changed = true;
-                std::cout << "Solved " << equations.size() << " equations with "
-                          << current_params.size() << " unknowns in " << steps << " steps.\n";
-            }
-            stats += "eqs: " + std::to_string(equations.size())
-                     + "\nnunkn: " + std::to_string(current_params.size());
-            back_substitution(subs);
+            back_substitution();
+            if (use_cache)
+                remember_solution(key);
             if (DEBUG)
             {
                 for (std::size_t i = 0; i < J.shape(0); ++i)
@@ -368,14 +1353,79 @@ SolveResult EquationSystem::solve()
                 }
             }
 
-            return SolveResult::OKAY;
+            return finish(SolveResult::OKAY);
         }
-        eval_jacobian(J, A, !is_drag_step);
-        solve_least_squares(A, B, X);
 
-        for (int i = 0; i < current_params.size(); i++)
+        // a solve that stopped making progress (converging to a non-zero least squares
+        // minimum, or oscillating) won't converge in the remaining steps either. Not checked
+        // while drag rows are in, a drag target out of reach is expected to stall.
+        if (line_search && !(dragging && is_drag_step))
+        {
+            double residual = 0.0;
+            for (std::size_t i = 0; i < equations.size(); i++)
+                residual += B(i) * B(i);
+            if (progress_residual < 0.0 || residual < divergence_ratio * progress_residual)
+            {
+                progress_residual = residual;
+                stalled_steps = 0;
+            }
+            else if (++stalled_steps >= divergence_steps)
+            {
+                break;
+            }
+        }
+
+        if (reporting)
+            t = clock::now();
+        if (sparse)
+        {
+            eval_sparse_jacobian(!is_drag_step);
+            if (reporting)
+            {
+                report.eval_jacobian_seconds += seconds_since(t);
+                t = clock::now();
+            }
+            solve_lsqr(B, X);
+        }
+        else if (keep_factorization)
         {
-            current_params[i]->set_value(current_params[i]->value() - X(i));
+            kept_step(is_drag_step);
+        }
+        else
+        {
+            eval_jacobian(J, A, !is_drag_step);
+            if (reporting)
+            {
+                report.eval_jacobian_seconds += seconds_since(t);
+                t = clock::now();
+            }
+            solve_least_squares(A, B, X);
+        }
+        if (reporting)
+        {
+            report.least_squares_seconds += seconds_since(t);
+            double norm = 0.0;
+            for (std::size_t i = 0; i < current_params.size(); i++)
+                norm += X(i) * X(i);
+            report.iterations.back().step_norm = std::sqrt(norm);
+        }
+
+        if (!line_search)
+        {
+            for (std::size_t i = 0; i < current_params.size(); i++)
+                values[i] -= X(i);
+            continue;
+        }
+
+        if (reporting)
+            t = clock::now();
+        double step_scale = 1.0;
+        residual_ready = take_step(/*clear_drag*/ !is_drag_step, step_scale);
+        residual_clear_drag = !is_drag_step;
+        if (reporting)
+        {
+            report.eval_seconds += seconds_since(t);
+            report.iterations.back().step_scale = step_scale;
         }
     } while (steps++ <= max_steps);
 
@@ -395,13 +1445,35 @@ SolveResult EquationSystem::solve()
         }
     }
 
-    is_converged(false, true);
+    if (cancelled)
+    {
+        if (best_residual >= 0.0)
+        {
+            std::copy(best_param_value.begin(), best_param_value.end(), values);
+            back_substitution();
+        }
+        else
+        {
+            // stopped before the first iterate, undo the warm start
+            revert_params();
+        }
+        return finish(SolveResult::CANCELLED);
+    }
+
+    if (reporting)
+        is_converged(/*check_drag*/ false, &report.not_converged);
+
+    // failing because of linearly dependent (conflicting) equations, tested where the solve
+    // started so that wherever a diverged iterate ended up doesn't decide it. Drag frames
+    // (keep_factorization) skip the rank test, a failed frame shouldn't pay a QR on top.
+    std::copy(values, values + current_params.size(), best_param_value.begin());
+    revert_params();
+    bool redundant = !keep_factorization && !find_dependent_equations().empty();
 
     if (revert_when_not_converged)
-    {
-        revert_params();
         dof_changed = false;
-    }
+    else
+        std::copy(best_param_value.begin(), best_param_value.end(), values);
 
-    return SolveResult::DIDNT_CONVERGE;
+    return finish(redundant ? SolveResult::REDUNDANT : SolveResult::DIDNT_CONVERGE);
 }
@@ -5,6 +5,11 @@
 
 #include "expression.hpp"
 
+const std::shared_ptr<Expr> zero = std::make_shared<Expr>(0.), one = std::make_shared<Expr>(1.),
+                            mOne = std::make_shared<Expr>(-1.), two = std::make_shared<Expr>(2.0),
+                            PI_E = std::make_shared<Expr>(M_PI),
+                            PI2_E = std::make_shared<Expr>(M_PI * 2);
+
 std::shared_ptr<Expr> expr(double);
 
 std::shared_ptr<Expr> operator-(const std::shared_ptr<Expr>& a)
@@ -491,6 +496,26 @@ void Expr::substitute(std::shared_ptr<Param<double>>& p, std::shared_ptr<Expr> e
     }
 }
 
+std::shared_ptr<Expr> Expr::substituted(
+    const std::unordered_map<std::shared_ptr<Param<double>>, std::shared_ptr<Expr>>& subs)
+{
+    if (op == Op::ParamOp)
+    {
+        auto it = subs.find(param);
+        if (it != subs.end())
+            return it->second;
+        return shared_from_this();
+    }
+    if (a == nullptr)
+        return shared_from_this();
+
+    auto na = a->substituted(subs);
+    auto nb = b != nullptr ? b->substituted(subs) : nullptr;
+    if (na == a && nb == b)
+        return shared_from_this();
+    return std::make_shared<Expr>(op, na, nb);
+}
+
 bool Expr::has_two_operands() const
 {
     return a != nullptr && b != nullptr;
@@ -1,8 +1,13 @@
 #include "gaussian_method.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 #include <xtensor/xtensor.hpp>
 #include <xtensor/xio.hpp>
 
+#include "dense_kernels.hpp"
+
 // copy A so it doesn't get overwritten
 // note: could use xt::linalg::rank
 int GaussianMethod::rank(xt::xtensor<double, 2> A)
@@ -51,65 +56,91 @@ int GaussianMethod::rank(xt::xtensor<double, 2> A)
 void GaussianMethod::solve(xt::xtensor<double, 2> A, xt::xtensor<double, 1> B,
                            xt::xtensor<double, 1>& X)
 {
-    std::ptrdiff_t rows = A.shape(0);
-    std::ptrdiff_t cols = A.shape(1);
-    double t = 0.0;
+    solve_in_place(A, B, X);
+}
 
-    for (std::ptrdiff_t r = 0; r < rows; r++)
+void GaussianMethod::solve_in_place(xt::xtensor<double, 2>& A, xt::xtensor<double, 1>& B,
+                                    xt::xtensor<double, 1>& X)
+{
+    std::size_t rows = A.shape(0);
+    std::size_t cols = A.shape(1);
+    double* a = A.data();
+    const DenseKernels& kernels = dense_kernels();
+    // nonzero multipliers of a row in the current panel, and the pivot rows they go with
+    double coefs[panel];
+    const double* pivot_rows[panel];
+
+    // Eliminated a panel of `panel` columns at a time: the panel columns right away, the
+    // columns after them once the whole panel is done, so that the rows are read once per
+    // panel instead of once per pivot. The multipliers wait below the diagonal until then.
+    for (std::size_t k0 = 0; k0 < rows; k0 += panel)
     {
-        std::ptrdiff_t mr = r;
-        double max = 0.0;
-        for (std::ptrdiff_t rr = r; rr < rows; rr++)
+        std::size_t k1 = std::min(k0 + panel, rows);
+        for (std::size_t r = k0; r < k1; r++)
         {
-            if (std::abs(A(rr, r)) <= max)
-                continue;
-            max = std::abs(A(rr, r));
-            mr = rr;
-        }
-
-        if (max < epsilon)
-            continue;
+            std::size_t mr = r;
+            double max = 0.0;
+            for (std::size_t rr = r; rr < rows; rr++)
+            {
+                if (std::abs(a[rr * cols + r]) <= max)
+                    continue;
+                max = std::abs(a[rr * cols + r]);
+                mr = rr;
+            }
 
-        for (std::ptrdiff_t c = 0; c < cols; c++)
-        {
-            t = A(r, c);
-            A(r, c) = A(mr, c);
-            A(mr, c) = t;
-        }
+            if (max < epsilon)
+            {
+                for (std::size_t rr = r + 1; rr < rows; rr++)
+                    a[rr * cols + r] = 0.0;
+                continue;
+            }
 
-        t = B(r);
-        B(r) = B(mr);
-        B(mr) = t;
+            // the multipliers of the panel move with their rows, the columns before it are done
+            if (mr != r)
+            {
+                std::swap_ranges(a + r * cols + k0, a + (r + 1) * cols, a + mr * cols + k0);
+                std::swap(B(r), B(mr));
+            }
 
-        // normalize
-        /*
-        double scale = A[r, r];
-        for(std::ptrdiff_t c = 0; c < cols; c++) {
-            A[r, c] /= scale;
+            const double* pivot = a + r * cols;
+            for (std::size_t rr = r + 1; rr < rows; rr++)
+            {
+                double* row = a + rr * cols;
+                double coef = row[r] / pivot[r];
+                row[r] = coef;
+                if (coef == 0.0)
+                    continue;
+                for (std::size_t c = r + 1; c < k1; c++)
+                    row[c] -= pivot[c] * coef;
+                B(rr) -= B(r) * coef;
+            }
         }
-        B[r] /= scale;
-        */
 
-        for (std::ptrdiff_t rr = r + 1; rr < rows; rr++)
+        // rows of the panel first, their columns after it are what the rows below subtract
+        for (std::size_t r = k0 + 1; k1 < cols && r < rows; r++)
         {
-            double coef = A(rr, r) / A(r, r);
-            for (std::ptrdiff_t c = 0; c < cols; c++)
+            std::size_t count = 0;
+            for (std::size_t k = k0; k < std::min(r, k1); k++)
             {
-                A(rr, c) -= A(r, c) * coef;
+                if (a[r * cols + k] == 0.0)
+                    continue;
+                coefs[count] = a[r * cols + k];
+                pivot_rows[count++] = a + k * cols + k1;
             }
-            B(rr) -= B(r) * coef;
+            if (count > 0)
+                kernels.update_row(cols - k1, count, coefs, pivot_rows, a + r * cols + k1);
         }
     }
 
-    for (std::ptrdiff_t r = rows; r >= 0; r--)
+    for (std::size_t r = rows; r-- > 0;)
     {
-        if (std::abs(A(r, r)) < epsilon)
-            continue;
-        double xx = B(r) / A(r, r);
-        for (std::ptrdiff_t rr = rows - 1; rr > r; rr--)
+        double diagonal = a[r * cols + r];
+        if (std::abs(diagonal) < epsilon)
         {
-            xx -= X(rr) * A(r, rr) / A(r, r);
+            X(r) = 0.0;
+            continue;
         }
-        X(r) = xx;
+        double sum = kernels.dot(rows - r - 1, a + r * cols + r + 1, X.data() + r + 1);
+        X(r) = (B(r) - sum) / diagonal;
     }
 }
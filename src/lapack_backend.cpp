@@ -0,0 +1,144 @@
+#include "dense_backend.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "gaussian_method.hpp"
+
+// Fortran BLAS/LAPACK entry points. The matrices here are row-major, which LAPACK sees as
+// their transposes: A (rows x cols) is A^T with leading dimension cols, and symmetric
+// matrices are their own transposes.
+extern "C"
+{
+    void dsyrk_(const char* uplo, const char* trans, const int* n, const int* k,
+                const double* alpha, const double* a, const int* lda, const double* beta,
+                double* c, const int* ldc);
+    void dpotrf_(const char* uplo, const int* n, double* a, const int* lda, int* info);
+    void dpotrs_(const char* uplo, const int* n, const int* nrhs, const double* a,
+                 const int* lda, double* b, const int* ldb, int* info);
+    void dgeqp3_(const int* m, const int* n, double* a, const int* lda, int* jpvt, double* tau,
+                 double* work, const int* lwork, int* info);
+}
+
+const char* LapackBackend::name() const
+{
+    return "lapack";
+}
+
+void LapackBackend::normal_matrix(const xt::xtensor<double, 2>& A,
+                                  const std::vector<double>& row_scale,
+                                  const std::vector<double>& col_scale,
+                                  xt::xtensor<double, 2>& M)
+{
+    std::size_t rows = A.shape(0);
+    std::size_t cols = A.shape(1);
+    if (rows == 0)
+        return;
+    m_scaled.resize(rows * cols);
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        for (std::size_t c = 0; c < cols; c++)
+            m_scaled[r * cols + c] = A(r, c) * row_scale[r] * col_scale[c];
+    }
+
+    // (S^T)^T S^T with S^T the cols x rows column-major view of the scaled A
+    int n = int(rows);
+    int k = int(cols);
+    int lda = std::max(k, 1);
+    double one = 1.0;
+    double zero = 0.0;
+    dsyrk_("U", "T", &n, &k, &one, m_scaled.data(), &lda, &zero, M.data(), &n);
+    // only the upper triangle (lower in row-major) is written
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        for (std::size_t c = r + 1; c < rows; c++)
+            M(r, c) = M(c, r);
+    }
+}
+
+void LapackBackend::solve_normal(xt::xtensor<double, 2>& M, xt::xtensor<double, 1>& B,
+                                 xt::xtensor<double, 1>& X)
+{
+    int n = int(M.shape(0));
+    if (n == 0)
+        return;
+    // dpotrf stops at the first non-positive pivot, M is kept for GaussianMethod then
+    m_factor.assign(M.begin(), M.end());
+    int info = 0;
+    dpotrf_("U", &n, m_factor.data(), &n, &info);
+
+    // a pivot that is positive but tiny is a dependent row too, solving with it would
+    // blow the step up where GaussianMethod would zero that unknown. The elimination pivots
+    // of M are the squares of the Cholesky ones, tested against the same epsilon.
+    for (int i = 0; info == 0 && i < n; i++)
+    {
+        double pivot = m_factor[std::size_t(i) * n + i];
+        if (pivot * pivot < GaussianMethod::epsilon)
+            info = i + 1;
+    }
+    if (info != 0)
+    {
+        GaussianMethod::solve_in_place(M, B, X);
+        return;
+    }
+
+    int nrhs = 1;
+    dpotrs_("U", &n, &nrhs, m_factor.data(), &n, B.data(), &n, &info);
+    for (int i = 0; i < n; i++)
+        X(i) = B(i);
+}
+
+std::size_t LapackBackend::rank(const xt::xtensor<double, 2>& A, std::size_t)
+{
+    std::size_t rows = A.shape(0);
+    std::size_t cols = A.shape(1);
+    m_dependent.clear();
+    if (rows == 0)
+        return 0;
+
+    // column-pivoted QR of A^T, i.e. rows of A in pivot order
+    m_scaled.assign(A.begin(), A.end());
+    m_norms.resize(rows);
+    for (std::size_t r = 0; r < rows; r++)
+    {
+        double sum = 0.0;
+        for (std::size_t c = 0; c < cols; c++)
+            sum += A(r, c) * A(r, c);
+        m_norms[r] = std::sqrt(sum);
+    }
+    int m = int(cols);
+    int n = int(rows);
+    int lda = std::max(m, 1);
+    m_pivots.assign(rows, 0);
+    m_tau.resize(std::max<std::size_t>(std::min(rows, cols), 1));
+    int info = 0;
+    int lwork = -1;
+    double query = 0.0;
+    dgeqp3_(&m, &n, m_scaled.data(), &lda, m_pivots.data(), m_tau.data(), &query, &lwork, &info);
+    lwork = int(query);
+    if (m_work.size() < std::size_t(lwork))
+        m_work.resize(lwork);
+    dgeqp3_(&m, &n, m_scaled.data(), &lda, m_pivots.data(), m_tau.data(), m_work.data(), &lwork,
+            &info);
+
+    // |R(k, k)| only decreases, rows from the first small one on depend on the ones before
+    std::size_t rank = 0;
+    std::size_t diagonal = std::min(rows, cols);
+    while (rank < diagonal)
+    {
+        double r = std::abs(m_scaled[rank * cols + rank]);
+        std::size_t row = std::size_t(m_pivots[rank] - 1);
+        if (r <= tolerance * std::max(1.0, m_norms[row]))
+            break;
+        rank++;
+    }
+    for (std::size_t k = rank; k < rows; k++)
+        m_dependent.push_back(std::size_t(m_pivots[k] - 1));
+    std::sort(m_dependent.begin(), m_dependent.end());
+    return rank;
+}
+
+const std::vector<std::size_t>& LapackBackend::dependent_rows() const
+{
+    return m_dependent;
+}
@@ -0,0 +1,65 @@
+#include "multi_start.hpp"
+
+#include <atomic>
+#include <vector>
+
+MultiStartResult multi_start(
+    std::size_t candidates,
+    const std::function<double(std::size_t, const std::shared_ptr<SolveControl>&)>& candidate,
+    ThreadPool* pool, double converged_residual /* = GaussianMethod::epsilon */)
+{
+    MultiStartResult res;
+    if (candidates == 0)
+        return res;
+
+    std::vector<std::shared_ptr<SolveControl>> controls(candidates);
+    for (auto& c : controls)
+        c = std::make_shared<SolveControl>();
+    std::vector<double> residuals(candidates, -1.0);
+    std::atomic<std::size_t> first_converged{ MultiStartResult::none };
+
+    auto run = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            if (i > first_converged.load() || controls[i]->should_stop())
+                continue;
+            double r = candidate(i, controls[i]);
+            if (controls[i]->should_stop())
+                continue;
+            residuals[i] = r;
+            if (r > converged_residual)
+                continue;
+
+            std::size_t current = first_converged.load();
+            while (i < current && !first_converged.compare_exchange_weak(current, i))
+            {
+            }
+            for (std::size_t j = i + 1; j < candidates; j++)
+                controls[j]->cancel();
+        }
+    };
+
+    if (pool != nullptr && pool->size() > 1)
+        pool->parallel_for(candidates, 1, run);
+    else
+        run(0, candidates);
+
+    res.best = first_converged.load();
+    if (res.best != MultiStartResult::none)
+    {
+        res.converged = true;
+        res.residual = residuals[res.best];
+        return res;
+    }
+    for (std::size_t i = 0; i < candidates; i++)
+    {
+        if (residuals[i] < 0.0)
+            continue;
+        if (res.best == MultiStartResult::none || residuals[i] < res.residual)
+        {
+            res.best = i;
+            res.residual = residuals[i];
+        }
+    }
+    return res;
+}
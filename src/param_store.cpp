@@ -0,0 +1,144 @@
+#include "param_store.hpp"
+
+#include <algorithm>
+
+ParamStore::~ParamStore()
+{
+    unbind();
+}
+
+void ParamStore::assign(const std::vector<ParamPtr>& params)
+{
+    // values move to the new slots through the params themselves
+    bool bound = m_bound;
+    unbind();
+    m_params.clear();
+    m_index.clear();
+    for (const auto& p : params)
+    {
+        if (m_index.emplace(p.get(), m_params.size()).second)
+            m_params.push_back(p);
+    }
+    m_values.assign(m_params.size(), 0.0);
+    m_reduceable.resize(m_params.size());
+    for (std::size_t i = 0; i < m_params.size(); i++)
+        m_reduceable[i] = m_params[i]->m_reduceable;
+    if (bound)
+        bind();
+}
+
+void ParamStore::clear()
+{
+    assign({});
+}
+
+std::size_t ParamStore::size() const
+{
+    return m_params.size();
+}
+
+std::size_t ParamStore::find(const Param<double>* p) const
+{
+    auto it = m_index.find(p);
+    return it == m_index.end() ? none : it->second;
+}
+
+const ParamPtr& ParamStore::param(std::size_t i) const
+{
+    return m_params[i];
+}
+
+const std::string& ParamStore::name(std::size_t i) const
+{
+    return m_params[i]->m_name;
+}
+
+bool ParamStore::reduceable(std::size_t i) const
+{
+    return m_reduceable[i];
+}
+
+double* ParamStore::values()
+{
+    return m_values.data();
+}
+
+const double* ParamStore::values() const
+{
+    return m_values.data();
+}
+
+double ParamStore::value(std::size_t i) const
+{
+    return m_bound ? m_values[i] : m_params[i]->value();
+}
+
+void ParamStore::set_value(std::size_t i, double v)
+{
+    if (m_bound)
+        m_values[i] = v;
+    else
+        m_params[i]->set_value(v);
+}
+
+void ParamStore::bind()
+{
+    if (m_bound)
+        return;
+    for (std::size_t i = 0; i < m_params.size(); i++)
+    {
+        try
+        {
+            m_params[i]->bind(&m_values[i]);
+        }
+        catch (...)
+        {
+            // bound to another store, leave the ones bound so far as they were
+            while (i-- > 0)
+                m_params[i]->unbind();
+            throw;
+        }
+    }
+    m_bound_values.assign(m_values.begin(), m_values.end());
+    m_bound = true;
+}
+
+void ParamStore::unbind()
+{
+    if (!m_bound)
+        return;
+    for (std::size_t i = 0; i < m_params.size(); i++)
+    {
+        m_params[i]->unbind();
+        if (m_values[i] != m_bound_values[i])
+            m_params[i]->m_changed = true;
+    }
+    m_bound = false;
+}
+
+bool ParamStore::is_bound() const
+{
+    return m_bound;
+}
+
+void ParamStore::save(double* to) const
+{
+    if (m_bound)
+    {
+        std::copy(m_values.begin(), m_values.end(), to);
+        return;
+    }
+    for (std::size_t i = 0; i < m_params.size(); i++)
+        to[i] = m_params[i]->value();
+}
+
+void ParamStore::restore(const double* from)
+{
+    if (m_bound)
+    {
+        std::copy(from, from + m_values.size(), m_values.begin());
+        return;
+    }
+    for (std::size_t i = 0; i < m_params.size(); i++)
+        m_params[i]->set_value(from[i]);
+}
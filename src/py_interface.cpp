@@ -10,11 +10,24 @@ namespace py = pybind11;
 
 PYBIND11_MODULE(adjacent_api, m)
 {
+    py::enum_<SolveResult>(m, "SolveResult")
+        .value("OKAY", SolveResult::OKAY)
+        .value("DIDNT_CONVERGE", SolveResult::DIDNT_CONVERGE)
+        .value("REDUNDANT", SolveResult::REDUNDANT)
+        .value("POSTPONE", SolveResult::POSTPONE)
+        .value("CANCELLED", SolveResult::CANCELLED);
+
     py::class_<Sketch>(m, "Sketch")
         .def(py::init<>())
         .def("add_entity", &Sketch::add_entity)
         .def("add_constraint", &Sketch::add_constraint)
-        .def("update", &Sketch::update);
+        .def("remove_entity", &Sketch::remove_entity)
+        .def("remove_constraint", &Sketch::remove_constraint)
+        .def("update", &Sketch::update)
+        .def("drag_point", &Sketch::drag_point)
+        .def("begin_drag", &Sketch::begin_drag)
+        .def("update_drag", &Sketch::update_drag)
+        .def("end_drag", &Sketch::end_drag);
 
     using Prm = Param<double>;
     py::class_<Prm, std::shared_ptr<Prm>>(m, "Param")
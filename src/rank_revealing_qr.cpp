@@ -0,0 +1,218 @@
+#include "rank_revealing_qr.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+void RankRevealingQR::clear()
+{
+    m_rows_count = 0;
+    m_cols = 0;
+    m_rows.clear();
+    m_basis.clear();
+    m_pivots.clear();
+    m_diagonal.clear();
+    m_dependent.clear();
+}
+
+void RankRevealingQR::factorize(const xt::xtensor<double, 2>& A)
+{
+    clear();
+    m_cols = A.shape(1);
+    add_rows(A, 0);
+}
+
+void RankRevealingQR::add_rows(const xt::xtensor<double, 2>& A, std::size_t first)
+{
+    std::size_t n_rows = A.shape(0);
+    std::size_t cols = A.shape(1);
+    if (first != rows() || (first > 0 && cols < m_cols))
+    {
+        factorize(A);
+        return;
+    }
+    if (first > 0 && cols > m_cols)
+    {
+        // the factored rows must not depend on the new columns for the basis to stay valid
+        for (std::size_t r = 0; r < first; r++)
+        {
+            for (std::size_t c = m_cols; c < cols; c++)
+            {
+                if (A(r, c) != 0.0)
+                {
+                    factorize(A);
+                    return;
+                }
+            }
+        }
+        widen(cols);
+    }
+    m_cols = cols;
+    if (first >= n_rows)
+        return;
+
+    std::size_t n_new = n_rows - first;
+    m_rows_count = n_rows;
+    m_rows.resize(n_rows * cols);
+    m_work.resize(n_new * cols);
+    for (std::size_t r = first; r < n_rows; r++)
+    {
+        for (std::size_t c = 0; c < cols; c++)
+        {
+            m_rows[r * cols + c] = A(r, c);
+            m_work[(r - first) * cols + c] = A(r, c);
+        }
+        project_out(&m_work[(r - first) * cols]);
+    }
+    process(first, n_new);
+}
+
+void RankRevealingQR::widen(std::size_t cols)
+{
+    // back to front, so that a value is moved before its old place is overwritten
+    auto pad = [this, cols](std::vector<double>& v, std::size_t count) {
+        v.resize(count * cols);
+        for (std::size_t r = count; r-- > 0;)
+        {
+            for (std::size_t c = cols; c-- > 0;)
+                v[r * cols + c] = c < m_cols ? v[r * m_cols + c] : 0.0;
+        }
+    };
+    pad(m_rows, m_rows_count);
+    pad(m_basis, m_pivots.size());
+    m_cols = cols;
+}
+
+// removes the components along the current basis from w
+void RankRevealingQR::project_out(double* w) const
+{
+    std::size_t rank = m_pivots.size();
+    for (std::size_t k = 0; k < rank; k++)
+    {
+        const double* q = &m_basis[k * m_cols];
+        double dot = 0.0;
+        for (std::size_t c = 0; c < m_cols; c++)
+            dot += q[c] * w[c];
+        if (dot == 0.0)
+            continue;
+        for (std::size_t c = 0; c < m_cols; c++)
+            w[c] -= dot * q[c];
+    }
+}
+
+// pivoted Gram-Schmidt over the work rows (already orthogonal to the basis),
+// work row i corresponds to row first + i
+void RankRevealingQR::process(std::size_t first, std::size_t n_new)
+{
+    std::vector<double> limit(n_new);
+    std::vector<double> residual(n_new);
+    std::vector<bool> done(n_new, false);
+    std::vector<bool> accepted(n_new, false);
+    for (std::size_t i = 0; i < n_new; i++)
+    {
+        double row_len = 0.0;
+        double res_len = 0.0;
+        for (std::size_t c = 0; c < m_cols; c++)
+        {
+            double v = m_rows[(first + i) * m_cols + c];
+            row_len += v * v;
+            res_len += m_work[i * m_cols + c] * m_work[i * m_cols + c];
+        }
+        limit[i] = tolerance * std::max(1.0, row_len);
+        residual[i] = res_len;
+    }
+
+    for (;;)
+    {
+        // pivot: the row that adds the most to the current row space
+        std::size_t best = n_new;
+        double best_ratio = 1.0;
+        for (std::size_t i = 0; i < n_new; i++)
+        {
+            if (done[i] || residual[i] <= limit[i])
+                continue;
+            double ratio = residual[i] / limit[i];
+            if (ratio > best_ratio)
+            {
+                best_ratio = ratio;
+                best = i;
+            }
+        }
+        if (best == n_new)
+            break;
+
+        done[best] = true;
+        double* w = &m_work[best * m_cols];
+        // second pass of Gram-Schmidt against everything accepted so far
+        project_out(w);
+        double len = 0.0;
+        for (std::size_t c = 0; c < m_cols; c++)
+            len += w[c] * w[c];
+        if (len <= limit[best])
+            continue;
+
+        double norm = std::sqrt(len);
+        std::size_t k = m_pivots.size();
+        m_basis.resize((k + 1) * m_cols);
+        double* q = &m_basis[k * m_cols];
+        for (std::size_t c = 0; c < m_cols; c++)
+            q[c] = w[c] / norm;
+        m_pivots.push_back(first + best);
+        m_diagonal.push_back(norm);
+        accepted[best] = true;
+
+        for (std::size_t i = 0; i < n_new; i++)
+        {
+            if (done[i])
+                continue;
+            double* wi = &m_work[i * m_cols];
+            double dot = 0.0;
+            for (std::size_t c = 0; c < m_cols; c++)
+                dot += q[c] * wi[c];
+            if (dot == 0.0)
+                continue;
+            double len_i = 0.0;
+            for (std::size_t c = 0; c < m_cols; c++)
+            {
+                wi[c] -= dot * q[c];
+                len_i += wi[c] * wi[c];
+            }
+            residual[i] = len_i;
+        }
+    }
+
+    for (std::size_t i = 0; i < n_new; i++)
+    {
+        if (!accepted[i])
+            m_dependent.push_back(first + i);
+    }
+}
+
+std::size_t RankRevealingQR::rank() const
+{
+    return m_pivots.size();
+}
+
+std::size_t RankRevealingQR::rows() const
+{
+    return m_rows_count;
+}
+
+std::size_t RankRevealingQR::cols() const
+{
+    return m_cols;
+}
+
+const std::vector<std::size_t>& RankRevealingQR::dependent_rows() const
+{
+    return m_dependent;
+}
+
+const std::vector<std::size_t>& RankRevealingQR::pivots() const
+{
+    return m_pivots;
+}
+
+const std::vector<double>& RankRevealingQR::diagonal() const
+{
+    return m_diagonal;
+}
@@ -0,0 +1,469 @@
+#include <cctype>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "recorder.hpp"
+#include "entity.hpp"
+#include "constraint.hpp"
+
+namespace
+{
+    const char* const constraint_names[] = { "INVALID", "PointOn",  "PointsCoincident",
+                                             "Parallel", "Length",  "PointsDistance",
+                                             "HV",       "Angle",   "Diameter",
+                                             "Tangent" };
+
+    CONSTRAINT_TYPE constraint_type(const std::string& name)
+    {
+        for (int i = 0; i <= CONSTRAINT_TYPE::Tangent; i++)
+        {
+            if (name == constraint_names[i])
+                return (CONSTRAINT_TYPE) i;
+        }
+        return CONSTRAINT_TYPE::INVALID;
+    }
+
+    // names end up as single tokens in the log
+    std::string token(std::string s)
+    {
+        if (s.empty())
+            return "_";
+        for (auto& c : s)
+        {
+            if (std::isspace((unsigned char) c))
+                c = '_';
+        }
+        return s;
+    }
+}
+
+SketchRecorder::SketchRecorder(std::ostream& out)
+    : m_out(out)
+{
+    m_out.precision(17);
+    m_out << "# adjacent sketch log 1\n";
+}
+
+std::size_t SketchRecorder::param_id(const ParamPtr& p)
+{
+    auto it = m_params.find(p);
+    if (it != m_params.end())
+        return it->second;
+    std::size_t id = m_params.size();
+    m_params[p] = id;
+    m_out << "param " << id << " " << token(p->m_name) << " " << p->value() << "\n";
+    return id;
+}
+
+std::size_t SketchRecorder::entity_id(Entity* e)
+{
+    auto it = m_entities.find(e);
+    if (it != m_entities.end())
+        return it->second;
+
+    std::vector<ParamPtr> params;
+    const char* kind;
+    if (auto* p = dynamic_cast<PointE*>(e))
+    {
+        kind = "point";
+        params = { p->x, p->y, p->z };
+    }
+    else if (auto* l = dynamic_cast<LineE*>(e))
+    {
+        kind = "line";
+        params = { l->p0.x, l->p0.y, l->p0.z, l->p1.x, l->p1.y, l->p1.z };
+    }
+    else if (auto* c = dynamic_cast<CircleE*>(e))
+    {
+        kind = "circle";
+        params = { c->_center.x, c->_center.y, c->_center.z, c->_radius };
+    }
+    else
+    {
+        throw std::runtime_error("cannot record entity " + e->to_string());
+    }
+
+    std::vector<std::size_t> ids;
+    for (const auto& p : params)
+        ids.push_back(param_id(p));
+
+    std::size_t id = m_entities.size();
+    m_entities[e] = id;
+    m_out << kind << " " << id;
+    for (auto pid : ids)
+        m_out << " " << pid;
+    m_out << "\n";
+    return id;
+}
+
+std::size_t SketchRecorder::constraint_id(Constraint* c)
+{
+    auto it = m_constraints.find(c);
+    if (it != m_constraints.end())
+        return it->second;
+
+    std::vector<std::size_t> ids;
+    for (auto* e : c->entities)
+        ids.push_back(entity_id(e));
+
+    std::size_t id = m_constraints.size();
+    m_constraints[c] = id;
+    m_out << "constraint " << id << " " << constraint_names[c->type] << " " << ids.size();
+    for (auto eid : ids)
+        m_out << " " << eid;
+
+    if (auto* hv = dynamic_cast<HVConstraint*>(c))
+        m_out << " " << hv->orientation;
+    else if (auto* parallel = dynamic_cast<ParallelConstraint*>(c))
+        m_out << " " << parallel->option_;
+    else if (auto* tangent = dynamic_cast<TangentConstraint*>(c))
+        m_out << " " << tangent->_option << " " << tangent->t0->value() << " "
+              << tangent->t1->value();
+    else if (auto* vc = dynamic_cast<ValueConstraint*>(c))
+    {
+        // once built, an angle over pi/2 holds the flipped value of its supplementary form
+        if (auto* angle = dynamic_cast<AngleConstraint*>(c))
+            m_out << " " << angle->supplementary;
+        m_out << " " << vc->value->value() << " " << vc->reference;
+    }
+    m_out << "\n";
+    return id;
+}
+
+void SketchRecorder::add_entity(Entity* e)
+{
+    auto id = entity_id(e);
+    m_out << "add_entity " << id << "\n";
+}
+
+void SketchRecorder::add_constraint(Constraint* c)
+{
+    auto id = constraint_id(c);
+    m_out << "add_constraint " << id << "\n";
+}
+
+void SketchRecorder::remove_entity(Entity* e)
+{
+    auto id = entity_id(e);
+    m_out << "remove_entity " << id << "\n";
+}
+
+void SketchRecorder::remove_constraint(Constraint* c)
+{
+    auto id = constraint_id(c);
+    m_out << "remove_constraint " << id << "\n";
+}
+
+void SketchRecorder::set_value(Constraint* c, double value)
+{
+    auto id = constraint_id(c);
+    m_out << "set_value " << id << " " << value << "\n";
+}
+
+void SketchRecorder::drag(PointE* p, double x, double y)
+{
+    auto id = entity_id(p);
+    m_out << "drag " << id << " " << x << " " << y << "\n";
+}
+
+void SketchRecorder::begin_drag(PointE* p)
+{
+    auto id = entity_id(p);
+    m_out << "begin_drag " << id << "\n";
+}
+
+void SketchRecorder::update_drag(PointE* p, double x, double y, int result)
+{
+    auto id = entity_id(p);
+    m_out << "update_drag " << id << " " << x << " " << y << " " << result << "\n";
+}
+
+void SketchRecorder::end_drag(PointE* p)
+{
+    auto id = entity_id(p);
+    m_out << "end_drag " << id << "\n";
+}
+
+void SketchRecorder::update(int result)
+{
+    m_out << "update " << result << std::endl;
+}
+
+void replay(std::istream& in, Sketch& sketch,
+            const std::function<void(const ReplayStep&)>& on_step)
+{
+    std::vector<ParamPtr> params;
+    std::vector<EntityPtr> entities;
+    std::vector<ConstraintPtr> constraints;
+
+    std::size_t line_number = 0;
+    std::string line;
+
+    auto fail = [&](const std::string& what) {
+        throw std::runtime_error("replay: line " + std::to_string(line_number) + ": " + what);
+    };
+    auto param_at = [&](std::size_t id) {
+        if (id >= params.size())
+            fail("unknown param " + std::to_string(id));
+        return params[id];
+    };
+    auto entity_at = [&](std::size_t id) {
+        if (id >= entities.size())
+            fail("unknown entity " + std::to_string(id));
+        return entities[id];
+    };
+    auto constraint_at = [&](std::size_t id) {
+        if (id >= constraints.size())
+            fail("unknown constraint " + std::to_string(id));
+        return constraints[id];
+    };
+    auto point_at = [&](std::size_t id) {
+        auto p = std::dynamic_pointer_cast<PointE>(entity_at(id));
+        if (p == nullptr)
+            fail("entity " + std::to_string(id) + " is not a point");
+        return p;
+    };
+    auto line_at = [&](std::size_t id) {
+        auto l = std::dynamic_pointer_cast<LineE>(entity_at(id));
+        if (l == nullptr)
+            fail("entity " + std::to_string(id) + " is not a line");
+        return l;
+    };
+    auto circle_at = [&](std::size_t id) {
+        auto c = std::dynamic_pointer_cast<CircleE>(entity_at(id));
+        if (c == nullptr)
+            fail("entity " + std::to_string(id) + " is not a circle");
+        return c;
+    };
+
+    while (std::getline(in, line))
+    {
+        line_number++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream is(line);
+        ReplayStep step;
+        step.line = line_number;
+        is >> step.op;
+
+        std::vector<std::size_t> ids;
+        auto read_ids = [&](std::size_t n) {
+            ids.resize(n);
+            for (auto& id : ids)
+            {
+                if (!(is >> id))
+                    fail("expected " + std::to_string(n) + " ids");
+            }
+        };
+        auto read_point = [&](std::size_t first) {
+            return PointE(param_at(ids[first]), param_at(ids[first + 1]),
+                          param_at(ids[first + 2]));
+        };
+
+        std::size_t id = 0;
+        if (!(is >> id))
+            fail("expected an id");
+
+        auto start = std::chrono::steady_clock::now();
+        if (step.op == "param")
+        {
+            std::string name;
+            double value;
+            if (!(is >> name >> value) || id != params.size())
+                fail("bad param");
+            params.push_back(param(name, value));
+        }
+        else if (step.op == "point" || step.op == "line" || step.op == "circle")
+        {
+            if (id != entities.size())
+                fail("entity ids must be consecutive");
+            if (step.op == "point")
+            {
+                read_ids(3);
+                entities.push_back(std::make_shared<PointE>(read_point(0)));
+            }
+            else if (step.op == "line")
+            {
+                read_ids(6);
+                entities.push_back(std::make_shared<LineE>(read_point(0), read_point(3)));
+            }
+            else
+            {
+                read_ids(4);
+                entities.push_back(std::make_shared<CircleE>(read_point(0), param_at(ids[3])));
+            }
+        }
+        else if (step.op == "constraint")
+        {
+            std::string type_name;
+            std::size_t n;
+            if (!(is >> type_name >> n) || id != constraints.size())
+                fail("bad constraint");
+            read_ids(n);
+            auto type = constraint_type(type_name);
+
+            ConstraintPtr c;
+            switch (type)
+            {
+                case CONSTRAINT_TYPE::PointOn:
+                    c = std::make_shared<PointOnConstraint>(point_at(ids.at(0)),
+                                                            entity_at(ids.at(1)));
+                    break;
+                case CONSTRAINT_TYPE::PointsCoincident:
+                {
+                    auto p0 = point_at(ids.at(0));
+                    auto p1 = point_at(ids.at(1));
+                    c = std::make_shared<PointsCoincidentConstraint>(p0, p1);
+                    break;
+                }
+                case CONSTRAINT_TYPE::Parallel:
+                {
+                    auto l0 = line_at(ids.at(0));
+                    auto l1 = line_at(ids.at(1));
+                    auto parallel = std::make_shared<ParallelConstraint>(l0, l1);
+                    int option;
+                    is >> option;
+                    parallel->option_ = (ParallelConstraint::Option) option;
+                    c = parallel;
+                    break;
+                }
+                case CONSTRAINT_TYPE::Length:
+                    c = std::make_shared<LengthConstraint>(entity_at(ids.at(0)), 0.0);
+                    break;
+                case CONSTRAINT_TYPE::PointsDistance:
+                    if (n == 1)
+                        c = std::make_shared<PointsDistanceConstraint>(line_at(ids[0]), 0.0);
+                    else
+                        c = std::make_shared<PointsDistanceConstraint>(point_at(ids.at(0)),
+                                                                       point_at(ids.at(1)), 0.0);
+                    break;
+                case CONSTRAINT_TYPE::HV:
+                {
+                    int orientation;
+                    is >> orientation;
+                    if (n == 1)
+                        c = std::make_shared<HVConstraint>(line_at(ids[0]),
+                                                           (HVOrientation) orientation);
+                    else
+                        c = std::make_shared<HVConstraint>(point_at(ids.at(0)), point_at(ids.at(1)),
+                                                           (HVOrientation) orientation);
+                    break;
+                }
+                case CONSTRAINT_TYPE::Angle:
+                {
+                    auto l0 = line_at(ids.at(0));
+                    auto l1 = line_at(ids.at(1));
+                    auto angle = std::make_shared<AngleConstraint>(l0, l1, 0.0);
+                    is >> angle->supplementary;
+                    c = angle;
+                    break;
+                }
+                case CONSTRAINT_TYPE::Diameter:
+                {
+                    auto e = entity_at(ids.at(0));
+                    c = std::make_shared<DiameterConstraint>(e, 0.0);
+                    break;
+                }
+                case CONSTRAINT_TYPE::Tangent:
+                {
+                    auto circle = circle_at(ids.at(0));
+                    auto l = line_at(ids.at(1));
+                    auto tangent = std::make_shared<TangentConstraint>(circle, l);
+                    int option;
+                    double t0, t1;
+                    is >> option >> t0 >> t1;
+                    tangent->_option = (TangentConstraint::Option) option;
+                    tangent->t0->set_value(t0);
+                    tangent->t1->set_value(t1);
+                    c = tangent;
+                    break;
+                }
+                default:
+                    fail("unknown constraint type " + type_name);
+            }
+
+            // the constructors may have solved for a value, the recorded one wins
+            if (auto* vc = dynamic_cast<ValueConstraint*>(c.get()))
+            {
+                double value;
+                bool reference;
+                if (!(is >> value >> reference))
+                    fail("expected a value");
+                vc->value->set_value(value);
+                vc->set_reference(reference);
+            }
+            if (is.fail())
+                fail("bad constraint fields");
+            constraints.push_back(c);
+        }
+        else if (step.op == "add_entity")
+        {
+            sketch.add_entity(entity_at(id));
+        }
+        else if (step.op == "add_constraint")
+        {
+            sketch.add_constraint(constraint_at(id));
+        }
+        else if (step.op == "remove_entity")
+        {
+            sketch.remove_entity(entity_at(id));
+        }
+        else if (step.op == "remove_constraint")
+        {
+            sketch.remove_constraint(constraint_at(id));
+        }
+        else if (step.op == "set_value")
+        {
+            double value;
+            auto vc = std::dynamic_pointer_cast<ValueConstraint>(constraint_at(id));
+            if (!(is >> value) || vc == nullptr)
+                fail("bad set_value");
+            start = std::chrono::steady_clock::now();
+            vc->set_value(value);
+        }
+        else if (step.op == "drag")
+        {
+            double x, y;
+            if (!(is >> x >> y))
+                fail("bad drag");
+            auto p = point_at(id);
+            start = std::chrono::steady_clock::now();
+            sketch.drag_point(p, x, y);
+        }
+        else if (step.op == "begin_drag")
+        {
+            auto p = point_at(id);
+            start = std::chrono::steady_clock::now();
+            sketch.begin_drag(p);
+        }
+        else if (step.op == "update_drag")
+        {
+            double x, y;
+            if (!(is >> x >> y >> step.recorded_result))
+                fail("bad update_drag");
+            start = std::chrono::steady_clock::now();
+            step.result = sketch.update_drag(x, y);
+        }
+        else if (step.op == "end_drag")
+        {
+            sketch.end_drag();
+        }
+        else if (step.op == "update")
+        {
+            step.recorded_result = (int) id;
+            step.result = sketch.update();
+        }
+        else
+        {
+            fail("unknown operation " + step.op);
+        }
+
+        step.seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (on_step)
+            on_step(step);
+    }
+}
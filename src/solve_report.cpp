@@ -0,0 +1,37 @@
+#include <sstream>
+
+#include "solve_report.hpp"
+
+std::string SolveReport::to_string() const
+{
+    std::ostringstream os;
+    os << *this;
+    return os.str();
+}
+
+std::ostream& operator<<(std::ostream& os, const SolveReport& report)
+{
+    os << "result: " << report.result << ", eqs: " << report.equations
+       << ", unkn: " << report.unknowns << ", subs: " << report.substitutions
+       << ", evals: " << report.iterations.size() << "\n";
+    os << "time: " << report.total_seconds * 1e3 << " ms (update_dirty "
+       << report.update_dirty_seconds * 1e3 << ", eval " << report.eval_seconds * 1e3
+       << ", jacobian " << report.eval_jacobian_seconds * 1e3 << ", least squares "
+       << report.least_squares_seconds * 1e3 << ")\n";
+    if (report.single_precision_steps > 0 || report.double_precision_fallbacks > 0)
+    {
+        os << "mixed precision: " << report.single_precision_steps << " single, "
+           << report.double_precision_fallbacks << " fell back to double\n";
+    }
+    for (const auto& e : report.not_converged)
+        os << "not converged: " << e << "\n";
+    for (std::size_t i = 0; i < report.iterations.size(); i++)
+    {
+        os << "  " << i << ": |f| = " << report.iterations[i].residual_norm
+           << ", |dx| = " << report.iterations[i].step_norm;
+        if (report.iterations[i].step_scale != 1.0)
+            os << " * " << report.iterations[i].step_scale;
+        os << "\n";
+    }
+    return os;
+}
@@ -0,0 +1,699 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "constraint.hpp"
+#include "dense_backend.hpp"
+#include "dense_kernels.hpp"
+#include "gaussian_method.hpp"
+#include "param_store.hpp"
+#include "recorder.hpp"
+#include "spatial_index.hpp"
+#include "thread_pool.hpp"
+
+// Behavioural checks of the solver and the sketch, each prints its name and whether it passed.
+
+namespace
+{
+    int failures = 0;
+
+    void check(const std::string& name, const std::function<bool()>& test)
+    {
+        bool ok = test();
+        std::cout << name << ": " << (ok ? "ok" : "FAILED") << "\n";
+        if (!ok)
+            failures++;
+    }
+
+    std::shared_ptr<PointE> point(double x, double y)
+    {
+        return std::make_shared<PointE>(param("x", x), param("y", y), param("z", 0.0));
+    }
+
+    // chain of lines with lengths and every third one horizontal, `n` lines long, starting
+    // with each line at dx = 0.9 so that the horizontal constraints don't hold yet
+    std::unique_ptr<Sketch> make_chain(int n, std::vector<std::shared_ptr<LineE>>& lines)
+    {
+        auto sketch = std::make_unique<Sketch>();
+        auto prev = point(0.0, 0.0);
+        for (int i = 0; i < n; i++)
+        {
+            auto next = point(prev->x->value() + 0.9, prev->y->value() + 0.3);
+            auto line = std::make_shared<LineE>(*prev, *next);
+            sketch->add_entity(line);
+            sketch->add_constraint(std::make_shared<LengthConstraint>(line, 1.0));
+            if (i % 3 == 0)
+                sketch->add_constraint(std::make_shared<HVConstraint>(line, OX));
+            lines.push_back(line);
+            prev = next;
+        }
+        return sketch;
+    }
+
+    // records how many rows the system asked to keep, and how many rank tests it ran
+    class KeptRowsBackend : public ReferenceBackend
+    {
+    public:
+        std::size_t kept_rows = 0;
+        std::size_t rank_tests = 0;
+
+        std::size_t rank(const xt::xtensor<double, 2>& A, std::size_t kept) override
+        {
+            kept_rows = kept;
+            rank_tests++;
+            return ReferenceBackend::rank(A, kept);
+        }
+    };
+}
+
+int main()
+{
+    check("unsatisfied offset relations are left to Newton", [] {
+        std::vector<std::shared_ptr<LineE>> lines;
+        auto sketch = make_chain(50, lines);
+        for (int i = 0; i < 3; i++)
+        {
+            if (sketch->update() != OKAY)
+                return false;
+        }
+        for (std::size_t i = 0; i < lines.size(); i++)
+        {
+            const auto& l = lines[i];
+            double dx = l->p1.x->value() - l->p0.x->value();
+            double dy = l->p1.y->value() - l->p0.y->value();
+            if (std::abs(std::hypot(dx, dy) - 1.0) > 1e-6)
+                return false;
+            if (i % 3 == 0 && std::abs(dx) > 1e-6)
+                return false;
+        }
+        return true;
+    });
+
+    check("rank test keeps the rows of unchanged equations", [] {
+        auto a = param("a", 1.0);
+        auto b = param("b", 2.0);
+        auto c = param("c", 3.0);
+        EquationSystem sys;
+        auto backend = std::make_unique<KeptRowsBackend>();
+        auto* kept = backend.get();
+        sys.dense_backend = std::move(backend);
+        sys.add_parameters({ a, b, c });
+        sys.add_equation(a->expr() * b->expr() - c->expr());
+        sys.add_equation(a->expr() + b->expr() * b->expr());
+        int dof;
+        bool full = sys.test_rank(dof);
+        if (!full || dof != 1 || kept->kept_rows != 0)
+            return false;
+        // an equation was added, the others and the values didn't change
+        sys.add_equation(a->expr() - b->expr() * c->expr());
+        full = sys.test_rank(dof);
+        return full && dof == 0 && kept->kept_rows == 2;
+    });
+
+    check("rank test doesn't keep rows when the values moved", [] {
+        // the rows are dependent at x = 0.5 only
+        auto x = param("x", 0.5);
+        auto y = param("y", 0.0);
+        EquationSystem sys;
+        auto backend = std::make_unique<KeptRowsBackend>();
+        auto* kept = backend.get();
+        sys.dense_backend = std::move(backend);
+        sys.add_parameters({ x, y });
+        sys.add_equation(x->expr() - y->expr());
+        sys.add_equation(x->expr() * x->expr() - y->expr());
+        int dof;
+        sys.test_rank(dof);
+        if (dof != 1)
+            return false;
+        x->set_value(2.0);
+        bool full = sys.test_rank(dof);
+        return full && dof == 0 && kept->kept_rows == 0;
+    });
+
+    check("adding to a sketch only appends rows to the rank test", [] {
+        std::vector<std::shared_ptr<LineE>> lines;
+        auto sketch = make_chain(6, lines);
+        EquationSystem sys;
+        auto backend = std::make_unique<KeptRowsBackend>();
+        auto* kept = backend.get();
+        sys.dense_backend = std::move(backend);
+        sketch->generate_equations(sys);
+        int dof;
+        sys.test_rank(dof);
+        std::size_t rows = sys.equations.size();
+        // new params and equations, generated again as Sketch::update does
+        for (int i = 0; i < 4; i++)
+        {
+            auto line = std::make_shared<LineE>(*point(i, 5.0), *point(i + 0.5, 6.0));
+            sketch->add_entity(line);
+            sketch->add_constraint(std::make_shared<LengthConstraint>(line, 1.0));
+        }
+        sys.clear();
+        sketch->generate_equations(sys);
+        sys.test_rank(dof);
+        EquationSystem fresh;
+        sketch->generate_equations(fresh);
+        int fresh_dof;
+        fresh.test_rank(fresh_dof);
+        return rows > 0 && kept->kept_rows == rows && sys.equations.size() > rows
+               && dof == fresh_dof;
+    });
+
+    check("dof of a structurally deficient system is the numeric one", [] {
+        // three multiples of the same equation in two params: structurally two of them are
+        // independent, numerically one is
+        auto a = param("a", 1.0);
+        auto b = param("b", 2.0);
+        EquationSystem sys;
+        sys.add_parameters({ a, b });
+        for (double k : { 1.0, 2.0, 3.0 })
+            sys.add_equation(expr(k) * (a->expr() + b->expr() - expr(3.0)));
+        int dof;
+        sys.test_rank(dof);
+        return sys.structural_dof() == 0 && dof == 1 && !sys.dof_is_lower_bound;
+    });
+
+    check("sparse systems are tested by their structural rank only", [] {
+        auto a = param("a", 1.0);
+        auto b = param("b", 1.0);
+        auto c = param("c", 0.0);
+        EquationSystem sys;
+        sys.add_parameters({ a, b });
+        sys.add_equation(a->expr() + b->expr() - expr(3.0));
+        sys.add_equation(expr(2.0) * (a->expr() + b->expr() - expr(3.0)));
+        if (sys.find_dependent_equations().empty())
+            return false;
+        // the rows the dense backend found dependent must not be reported for the sparse one
+        sys.linear_solver = LINEAR_LSQR;
+        sys.add_parameters({ c });
+        sys.add_equation(c->expr() - expr(1.0));
+        int dof;
+        return sys.test_rank(dof) && dof == 0 && sys.dof_is_lower_bound
+               && sys.find_dependent_equations().empty();
+    });
+
+    check("a param is bound to one store at a time", [] {
+        auto a = param("a", 1.0);
+        auto b = param("b", 2.0);
+        ParamStore first, second;
+        first.assign({ a });
+        second.assign({ b, a });
+        ParamStoreBinding binding(first);
+        try
+        {
+            second.bind();
+        }
+        catch (const std::runtime_error&)
+        {
+            // b was bound before a failed and is unbound again
+            b->set_value(3.0);
+            return !second.is_bound() && b->value() == 3.0 && second.values()[0] == 2.0;
+        }
+        return false;
+    });
+
+    check("a replayed angle over pi/2 keeps its supplementary form", [] {
+        auto l0 = std::make_shared<LineE>(*point(0.0, 0.0), *point(1.0, 0.0));
+        auto l1 = std::make_shared<LineE>(*point(0.0, 0.0), *point(-0.5, 1.0));
+        Sketch sketch;
+        sketch.add_entity(l0);
+        sketch.add_entity(l1);
+        sketch.add_constraint(std::make_shared<AngleConstraint>(l0, l1, 2.0));
+        // builds the equations, which flips the value
+        if (sketch.update() != OKAY)
+            return false;
+        std::stringstream log;
+        sketch.start_recording(log);
+
+        Sketch replayed;
+        replay(log, replayed);
+        if (replayed.update() != OKAY || replayed.constraints.size() != 1)
+            return false;
+        // already solved, so the replayed lines don't move
+        const auto& angle = *replayed.constraints.begin();
+        auto* r0 = dynamic_cast<LineE*>(angle->entities[0]);
+        auto* r1 = dynamic_cast<LineE*>(angle->entities[1]);
+        for (auto pair : { std::make_pair(l0.get(), r0), std::make_pair(l1.get(), r1) })
+        {
+            if (std::abs(pair.first->p1.x->value() - pair.second->p1.x->value()) > 1e-9
+                || std::abs(pair.first->p1.y->value() - pair.second->p1.y->value()) > 1e-9)
+                return false;
+        }
+        return true;
+    });
+
+    check("a moved entity is refitted alone", [] {
+        std::vector<std::shared_ptr<PointE>> points;
+        SpatialIndex index;
+        for (int i = 0; i < 200; i++)
+        {
+            points.push_back(point(i % 20, i / 20));
+            index.insert(points.back().get());
+        }
+        index.refresh();
+        auto& moved = points[57];
+        moved->x->set_value(-50.0);
+        moved->y->set_value(-50.0);
+        index.moved(moved.get());
+        auto hit = index.nearest_point(-49.0, -49.0);
+        auto old = index.nearest_point(17.0, 2.0);
+        return hit.point == moved.get() && old.point != moved.get() && old.distance == 1.0;
+    });
+
+    check("a drag frame refits the geometry it moved", [] {
+        auto line = std::make_shared<LineE>(*point(0.0, 0.0), *point(1.0, 0.0));
+        auto end = std::make_shared<PointE>(line->p1.x, line->p1.y, line->p1.z);
+        Sketch sketch;
+        sketch.add_entity(line);
+        sketch.add_entity(end);
+        sketch.add_constraint(std::make_shared<LengthConstraint>(line, 1.0));
+        sketch.spatial_index.refresh();
+        sketch.begin_drag(end);
+        if (sketch.update_drag(0.0, 3.0) != OKAY)
+            return false;
+        sketch.end_drag();
+        double x = 0.5 * (line->p0.x->value() + line->p1.x->value());
+        double y = 0.5 * (line->p0.y->value() + line->p1.y->value());
+        std::vector<SpatialHit> hits;
+        sketch.spatial_index.within_radius(x, y, 1e-6, hits);
+        auto hit = sketch.spatial_index.nearest_point(end->x->value(), end->y->value());
+        return y > 0.1 && hits.size() == 1 && hits[0].entity == line.get() && hit.distance == 0.0;
+    });
+
+    check("removing an entity removes the constraints on it", [] {
+        auto line = std::make_shared<LineE>(*point(0.0, 0.0), *point(1.0, 0.0));
+        auto end = std::make_shared<PointE>(line->p1.x, line->p1.y, line->p1.z);
+        auto other = point(3.0, 3.0);
+        Sketch sketch;
+        sketch.add_entity(line);
+        sketch.add_entity(end);
+        sketch.add_entity(other);
+        sketch.add_constraint(std::make_shared<LengthConstraint>(line, 2.0));
+        sketch.add_constraint(std::make_shared<HVConstraint>(end, other, OY));
+        sketch.remove_entity(line);
+        // the constraint on the end point stays, it doesn't reference the line
+        return sketch.entities.size() == 2 && sketch.constraints.size() == 1
+               && sketch.constraints_of(line.get()).empty() && sketch.spatial_index.size() == 2
+               && sketch.update() == OKAY;
+    });
+
+    check("constraints touching a point include those of the lines it ends", [] {
+        auto line = std::make_shared<LineE>(*point(0.0, 0.0), *point(1.0, 0.0));
+        auto end = std::make_shared<PointE>(line->p1.x, line->p1.y, line->p1.z);
+        auto other = point(3.0, 3.0);
+        Sketch sketch;
+        sketch.add_entity(line);
+        sketch.add_entity(end);
+        sketch.add_entity(other);
+        auto length = std::make_shared<LengthConstraint>(line, 2.0);
+        auto hv = std::make_shared<HVConstraint>(end, other, OY);
+        sketch.add_constraint(length);
+        sketch.add_constraint(hv);
+        auto touching = sketch.constraints_touching(end.get());
+        auto has = [&touching](const ConstraintPtr& c) {
+            return std::find(touching.begin(), touching.end(), c) != touching.end();
+        };
+        return touching.size() == 2 && has(length) && has(hv)
+               && sketch.constraints_touching(other.get()).size() == 1;
+    });
+
+    check("coincident points follow shared params and coincident constraints", [] {
+        auto line = std::make_shared<LineE>(*point(0.0, 0.0), *point(1.0, 0.0));
+        auto end = std::make_shared<PointE>(line->p1.x, line->p1.y, line->p1.z);
+        auto near = point(1.0, 0.1);
+        auto far = point(1.1, 0.0);
+        auto apart = point(5.0, 5.0);
+        Sketch sketch;
+        for (const EntityPtr& e : std::vector<EntityPtr>{ line, end, near, far, apart })
+            sketch.add_entity(e);
+        sketch.add_constraint(std::make_shared<PointsCoincidentConstraint>(end, near));
+        sketch.add_constraint(std::make_shared<PointsCoincidentConstraint>(near, far));
+        auto points = sketch.coincident_points(end.get());
+        auto has = [&points](PointE* p) {
+            return std::find(points.begin(), points.end(), p) != points.end();
+        };
+        return points.size() == 3 && has(&line->p1) && has(near.get()) && has(far.get())
+               && sketch.is_coincident_with(far.get(), &line->p1)
+               && !sketch.is_coincident_with(end.get(), apart.get())
+               && !sketch.is_coincident_with(end.get(), &line->p0);
+    });
+
+    check("a drag solves only the geometry connected to the dragged point", [] {
+        std::vector<std::shared_ptr<LineE>> lines;
+        Sketch sketch;
+        for (double y : { 0.0, 5.0 })
+        {
+            auto line = std::make_shared<LineE>(*point(0.0, y), *point(1.0, y));
+            sketch.add_entity(line);
+            sketch.add_constraint(std::make_shared<LengthConstraint>(line, 1.0));
+            lines.push_back(line);
+        }
+        auto end = std::make_shared<PointE>(lines[0]->p1.x, lines[0]->p1.y, lines[0]->p1.z);
+        sketch.add_entity(end);
+        sketch.begin_drag(end);
+        const auto& params = sketch.drag_sys->parameters;
+        auto solved = [&params](const ParamPtr& p) {
+            return std::find(params.begin(), params.end(), p) != params.end();
+        };
+        bool component = solved(lines[0]->p0.x) && solved(lines[0]->p1.y)
+                         && !solved(lines[1]->p0.x) && !solved(lines[1]->p1.x);
+        bool moved = sketch.update_drag(1.0, 1.0) == OKAY && lines[0]->p1.y->value() > 0.1;
+        sketch.end_drag();
+        return component && moved && lines[1]->p1.x->value() == 1.0
+               && lines[1]->p1.y->value() == 5.0;
+    });
+
+#ifdef ADJACENT_USE_LAPACK
+    check("the LAPACK backend agrees with the reference one on rank deficient systems", [] {
+        // row 3 is row 0 + row 1 up to 3e-6, row 4 is 2 * row 2. The entries are small, so
+        // the normal matrix of the first four rows has a last pivot of 9e-12, which both
+        // backends have to treat as zero.
+        double rows[5][4] = { { 0.03, 0.0, 0.0, 0.01 },
+                              { 0.0, 0.03, 0.0, 0.0 },
+                              { 0.0, 0.0, 0.0, 0.02 },
+                              { 0.03, 0.03, 3e-6, 0.01 },
+                              { 0.0, 0.0, 0.0, 0.04 } };
+        xt::xtensor<double, 2> A = xt::zeros<double>({ std::size_t(5), std::size_t(4) });
+        for (std::size_t r = 0; r < 5; r++)
+        {
+            for (std::size_t c = 0; c < 4; c++)
+                A(r, c) = rows[r][c];
+        }
+        ReferenceBackend reference;
+        LapackBackend lapack;
+        if (reference.rank(A, 0) != 3 || lapack.rank(A, 0) != 3
+            || reference.dependent_rows().size() != lapack.dependent_rows().size())
+            return false;
+
+        // without row 4 the normal matrix is positive definite
+        std::size_t n = 4;
+        xt::xtensor<double, 2> A4 = xt::empty<double>({ n, std::size_t(4) });
+        for (std::size_t r = 0; r < n; r++)
+        {
+            for (std::size_t c = 0; c < 4; c++)
+                A4(r, c) = rows[r][c];
+        }
+        std::vector<double> ones_r(n, 1.0), ones_c(4, 1.0);
+        xt::xtensor<double, 2> M0 = xt::empty<double>({ n, n });
+        xt::xtensor<double, 2> M1 = xt::empty<double>({ n, n });
+        reference.normal_matrix(A4, ones_r, ones_c, M0);
+        lapack.normal_matrix(A4, ones_r, ones_c, M1);
+        xt::xtensor<double, 1> B0 = xt::empty<double>({ n });
+        xt::xtensor<double, 1> B1 = xt::empty<double>({ n });
+        xt::xtensor<double, 1> X0 = xt::empty<double>({ n });
+        xt::xtensor<double, 1> X1 = xt::empty<double>({ n });
+        for (std::size_t r = 0; r < n; r++)
+        {
+            for (std::size_t c = 0; c < n; c++)
+            {
+                if (std::abs(M0(r, c) - M1(r, c)) > 1e-15)
+                    return false;
+            }
+            B0(r) = B1(r) = 1e-3 * (r + 1) * (r + 1);
+        }
+        reference.solve_normal(M0, B0, X0);
+        lapack.solve_normal(M1, B1, X1);
+        for (std::size_t r = 0; r < n; r++)
+        {
+            if (std::abs(X0(r) - X1(r)) > 1e-9 * std::max(1.0, std::abs(X0(r))))
+                return false;
+        }
+        return true;
+    });
+#endif
+
+    check("a worker runs its tasks in submission order", [] {
+        ThreadPool pool(1);
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool released = false;
+        std::vector<int> order;
+        // holds the worker until all the others are queued behind it
+        pool.submit([&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&released] { return released; });
+        });
+        for (int i = 0; i < 5; i++)
+        {
+            pool.submit([&, i] {
+                std::lock_guard<std::mutex> lock(mutex);
+                order.push_back(i);
+                cv.notify_all();
+            });
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        released = true;
+        cv.notify_all();
+        cv.wait(lock, [&order] { return order.size() == 5; });
+        return order == std::vector<int>{ 0, 1, 2, 3, 4 };
+    });
+
+    check("an expired update leaves the params and rebuilds on the next one", [] {
+        std::vector<std::shared_ptr<LineE>> lines;
+        auto sketch = make_chain(20, lines);
+        std::vector<double> before;
+        for (const auto& l : lines)
+            before.push_back(l->p1.x->value());
+        auto res = sketch->update_async(std::chrono::steady_clock::now()).get();
+        if (res != CANCELLED)
+            return false;
+        for (std::size_t i = 0; i < lines.size(); i++)
+        {
+            if (lines[i]->p1.x->value() != before[i])
+                return false;
+        }
+        return sketch->update() == OKAY;
+    });
+
+    check("setting a constraint value stops the pending update", [] {
+        std::vector<std::shared_ptr<LineE>> lines;
+        auto sketch = make_chain(50, lines);
+        auto line = std::make_shared<LineE>(*point(0.0, 5.0), *point(2.0, 5.0));
+        auto length = std::make_shared<LengthConstraint>(line, 1.0);
+        sketch->add_entity(line);
+        sketch->add_constraint(length);
+        auto pending = sketch->update_async();
+        length->set_value(1.5);
+        bool stopped = pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        return stopped && sketch->update() == OKAY;
+    });
+
+    check("a failed drag solve skips the redundancy test", [] {
+        auto a = param("a", 0.0);
+        SolveResult res[2];
+        std::size_t rank_tests[2];
+        for (int keep = 0; keep < 2; keep++)
+        {
+            EquationSystem sys;
+            auto backend = std::make_unique<KeptRowsBackend>();
+            auto* counter = backend.get();
+            sys.dense_backend = std::move(backend);
+            sys.linear_solver = LINEAR_DENSE;
+            sys.keep_factorization = keep == 1;
+            sys.add_parameters({ a });
+            sys.add_equation(a->expr() - expr(1.0));
+            sys.add_equation(a->expr() - expr(2.0));
+            res[keep] = sys.solve();
+            rank_tests[keep] = counter->rank_tests;
+        }
+        return res[0] == REDUNDANT && res[1] == DIDNT_CONVERGE && rank_tests[1] == 0;
+    });
+
+    check("starting and stopping a recording stop the pending update", [] {
+        std::vector<std::shared_ptr<LineE>> lines;
+        auto sketch = make_chain(50, lines);
+        std::ostringstream log;
+        auto pending = sketch->update_async();
+        sketch->start_recording(log);
+        bool stopped = pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        pending = sketch->update_async();
+        sketch->stop_recording();
+        stopped = stopped
+                  && pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        return stopped && sketch->update() == OKAY;
+    });
+
+    check("parallel lines pick the direction they are closest to", [] {
+        auto l0 = std::make_shared<LineE>(*point(0.0, 0.0), *point(1.0, 0.0));
+        auto same = std::make_shared<LineE>(*point(0.0, 1.0), *point(1.0, 1.1));
+        auto opposite = std::make_shared<LineE>(*point(0.0, 1.0), *point(-1.0, 1.1));
+        ParallelConstraint codirected(l0, same);
+        ParallelConstraint antidirected(l0, opposite);
+        return codirected.option_ == ParallelConstraint::Codirected
+               && antidirected.option_ == ParallelConstraint::Antidirected;
+    });
+
+    check("a failed solve reports the equations that didn't converge", [] {
+        auto a = param("a", 0.0);
+        EquationSystem sys;
+        sys.add_parameters({ a });
+        sys.add_equation(a->expr() - expr(1.0));
+        sys.add_equation(a->expr() - expr(2.0));
+        SolveReport last;
+        sys.report_sink = [&last](const SolveReport& report) { last = report; };
+        auto res = sys.solve();
+        return res != OKAY && !last.not_converged.empty()
+               && last.to_string().find("not converged: ") != std::string::npos;
+    });
+
+    check("residuals are tested relative to how much they move with the params", [] {
+        // a ratio of large coordinates is only as large as its own sensitivity, the sum of
+        // them is 2000 times that
+        auto x = param("x", 1000.0);
+        auto y = param("y", 999.0);
+        auto t = param("t", 0.0);
+        EquationSystem sys;
+        sys.add_parameters({ x, y, t });
+        sys.add_equation(x->expr() + y->expr() - expr(2001.0));
+        sys.add_equation(t->expr() - y->expr() / x->expr());
+        if (sys.solve() != OKAY)
+            return false;
+        double eps = GaussianMethod::epsilon;
+        return sys.residual_tolerance(0) > 1000.0 * eps && sys.residual_tolerance(1) < 10.0 * eps;
+    });
+
+    check("mixed precision solves a well conditioned sketch like the double path", [] {
+        std::vector<double> values[2];
+        std::size_t single_steps = 0;
+        for (int mixed = 0; mixed < 2; mixed++)
+        {
+            std::vector<std::shared_ptr<LineE>> lines;
+            auto sketch = make_chain(12, lines);
+            EquationSystem sys;
+            sketch->generate_equations(sys);
+            sys.linear_solver = LINEAR_DENSE;
+            sys.mixed_precision = mixed == 1;
+            sys.report_sink = [&](const SolveReport& report) {
+                if (mixed == 1)
+                    single_steps += report.single_precision_steps;
+            };
+            if (sys.solve() != OKAY)
+                return false;
+            for (const auto& line : lines)
+                for (const auto& p : line->parameters())
+                    values[mixed].push_back(p->value());
+        }
+        bool same = values[0].size() == values[1].size();
+        for (std::size_t i = 0; same && i < values[0].size(); i++)
+            same = std::abs(values[0][i] - values[1][i]) < 1e-9;
+        return single_steps > 0 && same;
+    });
+
+    check("the vector kernels match the scalar ones", [] {
+        const DenseKernels* scalar = find_dense_kernels("scalar");
+        // the sums are reordered, so compare relative to the sum of the magnitudes
+        auto close = [](double a, double b, double scale) {
+            return std::abs(a - b) <= 1e-14 * scale;
+        };
+        bool ok = true;
+        for (const char* isa : { "avx2", "avx512" })
+        {
+            const DenseKernels* kernels = find_dense_kernels(isa);
+            if (!kernels)
+                continue;
+            for (std::size_t n = 0; n <= 70; n++)
+            {
+                std::vector<double> rows[4];
+                std::vector<double> x(n), y0(n), y1(n), scale(n, 0.0);
+                for (std::size_t i = 0; i < n; i++)
+                {
+                    x[i] = std::sin(0.7 * i + n);
+                    y0[i] = std::cos(1.3 * i - n);
+                    for (std::size_t k = 0; k < 4; k++)
+                        rows[k].push_back(std::sin(0.3 * i * (k + 1) + 0.1 * n));
+                }
+                y1 = y0;
+                double coefs[4] = { 0.5, -1.25, 2.0, -0.75 };
+                const double* row_ptrs[4] = { rows[0].data(), rows[1].data(), rows[2].data(),
+                                              rows[3].data() };
+                scalar->update_row(n, 4, coefs, row_ptrs, y0.data());
+                kernels->update_row(n, 4, coefs, row_ptrs, y1.data());
+                double dot_scale = 0.0;
+                for (std::size_t i = 0; i < n; i++)
+                {
+                    dot_scale += std::abs(x[i] * rows[0][i]);
+                    for (std::size_t k = 0; k < 4; k++)
+                        scale[i] += std::abs(coefs[k] * rows[k][i]);
+                    ok = ok && close(y0[i], y1[i], scale[i] + std::abs(y0[i]));
+                }
+                ok = ok && close(scalar->dot(n, x.data(), rows[0].data()),
+                                 kernels->dot(n, x.data(), rows[0].data()), dot_scale);
+                double out0[4] = { 1.0, 2.0, 3.0, 4.0 };
+                double out1[4] = { 1.0, 2.0, 3.0, 4.0 };
+                scalar->dot4(n, x.data(), row_ptrs, out0);
+                kernels->dot4(n, x.data(), row_ptrs, out1);
+                for (std::size_t k = 0; k < 4; k++)
+                    ok = ok && close(out0[k], out1[k], std::abs(out0[k]) + 4.0 * n);
+            }
+        }
+        return ok;
+    });
+
+    check("the blocked elimination matches a plain one", [] {
+        // larger than a panel, with rows that need swapping
+        std::size_t n = 70;
+        xt::xtensor<double, 2> A = xt::empty<double>({ n, n });
+        xt::xtensor<double, 1> B = xt::empty<double>({ n });
+        xt::xtensor<double, 1> X = xt::empty<double>({ n });
+        for (std::size_t r = 0; r < n; r++)
+        {
+            for (std::size_t c = 0; c < n; c++)
+                A(r, c) = std::sin(0.37 * r * c + r + 2.0 * c);
+            A(r, (r * 11) % n) += 4.0 * std::sqrt(double(n));
+            B(r) = std::cos(0.5 * r);
+        }
+
+        // partial pivoting one column at a time, then back substitution
+        std::vector<std::vector<double>> M(n, std::vector<double>(n + 1));
+        for (std::size_t r = 0; r < n; r++)
+        {
+            for (std::size_t c = 0; c < n; c++)
+                M[r][c] = A(r, c);
+            M[r][n] = B(r);
+        }
+        for (std::size_t k = 0; k < n; k++)
+        {
+            std::size_t mr = k;
+            for (std::size_t r = k + 1; r < n; r++)
+                if (std::abs(M[r][k]) > std::abs(M[mr][k]))
+                    mr = r;
+            std::swap(M[k], M[mr]);
+            for (std::size_t r = k + 1; r < n; r++)
+            {
+                double coef = M[r][k] / M[k][k];
+                for (std::size_t c = k; c <= n; c++)
+                    M[r][c] -= M[k][c] * coef;
+            }
+        }
+        std::vector<double> expected(n);
+        for (std::size_t r = n; r-- > 0;)
+        {
+            double sum = M[r][n];
+            for (std::size_t c = r + 1; c < n; c++)
+                sum -= M[r][c] * expected[c];
+            expected[r] = sum / M[r][r];
+        }
+
+        GaussianMethod::solve_in_place(A, B, X);
+        double max = 0.0;
+        double error = 0.0;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            max = std::max(max, std::abs(expected[i]));
+            error = std::max(error, std::abs(X(i) - expected[i]));
+        }
+        return error <= 1e-14 * n * max;
+    });
+
+    if (failures > 0)
+    {
+        std::cout << failures << " check(s) failed\n";
+        return 1;
+    }
+    return 0;
+}
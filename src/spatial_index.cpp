@@ -0,0 +1,549 @@
+#include "spatial_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "entity.hpp"
+
+namespace
+{
+    const std::size_t leaf_size = 4;
+
+    double distance_to_segment(double x, double y, double ax, double ay, double bx, double by)
+    {
+        double ex = bx - ax;
+        double ey = by - ay;
+        double len2 = ex * ex + ey * ey;
+        double t = len2 > 0.0 ? ((x - ax) * ex + (y - ay) * ey) / len2 : 0.0;
+        t = std::min(1.0, std::max(0.0, t));
+        return std::hypot(x - (ax + t * ex), y - (ay + t * ey));
+    }
+
+    // the ray is (x, y) + s (ux, uy) with |u| = 1, s >= 0. Each test returns the s where the
+    // ray comes within tol of the geometry, or -1 if it doesn't.
+
+    double ray_point(double x, double y, double ux, double uy, double px, double py, double tol)
+    {
+        double s = std::max(0.0, (px - x) * ux + (py - y) * uy);
+        return std::hypot(px - (x + s * ux), py - (y + s * uy)) <= tol ? s : -1.0;
+    }
+
+    double ray_segment(double x, double y, double ux, double uy, double ax, double ay, double bx,
+                       double by, double tol)
+    {
+        double ex = bx - ax;
+        double ey = by - ay;
+        double denom = ux * ey - uy * ex;
+        if (denom != 0.0)
+        {
+            double s = ((ax - x) * ey - (ay - y) * ex) / denom;
+            double v = ((ax - x) * uy - (ay - y) * ux) / denom;
+            if (s >= 0.0 && v >= 0.0 && v <= 1.0)
+                return s;
+        }
+        // no crossing, the closest approach is at an end of the segment or the ray's origin
+        double best = -1.0;
+        for (double s : { ray_point(x, y, ux, uy, ax, ay, tol), ray_point(x, y, ux, uy, bx, by, tol) })
+        {
+            if (s >= 0.0 && (best < 0.0 || s < best))
+                best = s;
+        }
+        if (distance_to_segment(x, y, ax, ay, bx, by) <= tol)
+            best = 0.0;
+        return best;
+    }
+
+    double ray_circle(double x, double y, double ux, double uy, double cx, double cy, double r,
+                      double tol)
+    {
+        double fx = x - cx;
+        double fy = y - cy;
+        double d = std::hypot(fx, fy);
+        if (std::abs(d - r) <= tol)
+            return 0.0;
+        // outside the band around the circle the ray enters it through the outer edge, inside
+        // it leaves through the inner one
+        bool outside = d > r;
+        double edge = outside ? r + tol : r - tol;
+        double b = fx * ux + fy * uy;
+        double disc = b * b - (d * d - edge * edge);
+        if (disc < 0.0)
+            return -1.0;
+        double s = outside ? -b - std::sqrt(disc) : -b + std::sqrt(disc);
+        return s >= 0.0 ? s : -1.0;
+    }
+
+    bool by_distance(const SpatialHit& a, const SpatialHit& b)
+    {
+        return a.distance < b.distance;
+    }
+}
+
+void SpatialIndex::Box::add(const Box& b)
+{
+    min_x = std::min(min_x, b.min_x);
+    min_y = std::min(min_y, b.min_y);
+    max_x = std::max(max_x, b.max_x);
+    max_y = std::max(max_y, b.max_y);
+}
+
+bool SpatialIndex::Box::operator==(const Box& b) const
+{
+    return min_x == b.min_x && min_y == b.min_y && max_x == b.max_x && max_y == b.max_y;
+}
+
+double SpatialIndex::Box::extent() const
+{
+    if (min_x > max_x)
+        return 0.0;
+    return (max_x - min_x) + (max_y - min_y);
+}
+
+double SpatialIndex::Box::distance(double x, double y) const
+{
+    double dx = std::max(0.0, std::max(min_x - x, x - max_x));
+    double dy = std::max(0.0, std::max(min_y - y, y - max_y));
+    return std::hypot(dx, dy);
+}
+
+void SpatialIndex::insert(Entity* e)
+{
+    Kind kind;
+    if (dynamic_cast<PointE*>(e) != nullptr)
+        kind = PointKind;
+    else if (dynamic_cast<LineE*>(e) != nullptr)
+        kind = LineKind;
+    else if (dynamic_cast<CircleE*>(e) != nullptr)
+        kind = CircleKind;
+    else
+        return;
+    if (!m_index.emplace(e, m_items.size()).second)
+        return;
+    m_items.push_back({ e, kind, Box() });
+    m_rebuild = true;
+}
+
+void SpatialIndex::remove(Entity* e)
+{
+    auto it = m_index.find(e);
+    if (it == m_index.end())
+        return;
+    std::size_t i = it->second;
+    m_index.erase(it);
+    if (i != m_items.size() - 1)
+    {
+        m_items[i] = m_items.back();
+        m_index[m_items[i].entity] = i;
+    }
+    m_items.pop_back();
+    m_rebuild = true;
+}
+
+void SpatialIndex::clear()
+{
+    m_items.clear();
+    m_index.clear();
+    m_nodes.clear();
+    m_order.clear();
+    m_moved.clear();
+    m_rebuild = false;
+    m_stale = false;
+}
+
+std::size_t SpatialIndex::size() const
+{
+    return m_items.size();
+}
+
+void SpatialIndex::invalidate()
+{
+    m_stale = true;
+}
+
+void SpatialIndex::moved(Entity* e)
+{
+    auto it = m_index.find(e);
+    if (it == m_index.end() || m_items[it->second].moved)
+        return;
+    m_items[it->second].moved = true;
+    m_moved.push_back(it->second);
+}
+
+void SpatialIndex::update_box(Item& item) const
+{
+    Box& box = item.box;
+    switch (item.kind)
+    {
+    case PointKind:
+    {
+        auto* p = static_cast<PointE*>(item.entity);
+        box.min_x = box.max_x = p->x->value();
+        box.min_y = box.max_y = p->y->value();
+        break;
+    }
+    case LineKind:
+    {
+        auto* l = static_cast<LineE*>(item.entity);
+        double x0 = l->p0.x->value();
+        double y0 = l->p0.y->value();
+        double x1 = l->p1.x->value();
+        double y1 = l->p1.y->value();
+        box.min_x = std::min(x0, x1);
+        box.max_x = std::max(x0, x1);
+        box.min_y = std::min(y0, y1);
+        box.max_y = std::max(y0, y1);
+        break;
+    }
+    case CircleKind:
+    {
+        auto* c = static_cast<CircleE*>(item.entity);
+        double x = c->center().x->value();
+        double y = c->center().y->value();
+        double r = std::abs(c->_radius->value());
+        box.min_x = x - r;
+        box.max_x = x + r;
+        box.min_y = y - r;
+        box.max_y = y + r;
+        break;
+    }
+    }
+}
+
+void SpatialIndex::refresh()
+{
+    for (auto& item : m_items)
+    {
+        update_box(item);
+        item.moved = false;
+    }
+    m_moved.clear();
+    m_stale = false;
+    if (m_rebuild)
+    {
+        build();
+        return;
+    }
+    // moving geometry loosens the boxes of the tree it was built in, rebuild once the
+    // queries visit noticeably more nodes than in a fresh one
+    m_extent = refit();
+    if (m_extent > 2.0 * m_built_extent)
+        build();
+}
+
+void SpatialIndex::refit_moved()
+{
+    for (std::size_t i : m_moved)
+    {
+        Item& item = m_items[i];
+        item.moved = false;
+        update_box(item);
+        // the boxes above stop changing where one of them didn't
+        for (std::size_t n = item.leaf; n != none; n = m_nodes[n].parent)
+        {
+            Node& node = m_nodes[n];
+            Box old = node.box;
+            fit(node);
+            if (node.box == old)
+                break;
+            m_extent += node.box.extent() - old.extent();
+        }
+    }
+    m_moved.clear();
+    if (m_extent > 2.0 * m_built_extent)
+        build();
+}
+
+void SpatialIndex::build()
+{
+    m_rebuild = false;
+    m_nodes.clear();
+    m_order.resize(m_items.size());
+    for (std::size_t i = 0; i < m_order.size(); i++)
+        m_order[i] = i;
+    if (m_items.empty())
+    {
+        m_built_extent = m_extent = 0.0;
+        return;
+    }
+    m_nodes.reserve(2 * m_items.size() / leaf_size + 1);
+    m_nodes.emplace_back();
+    m_nodes[0].count = m_items.size();
+    split(0);
+    for (std::size_t n = 0; n < m_nodes.size(); n++)
+    {
+        const Node& node = m_nodes[n];
+        for (std::size_t i = node.first; i < node.first + node.count; i++)
+            m_items[m_order[i]].leaf = n;
+    }
+    m_built_extent = m_extent = refit();
+}
+
+void SpatialIndex::split(std::size_t node)
+{
+    std::size_t first = m_nodes[node].first;
+    std::size_t count = m_nodes[node].count;
+    if (count <= leaf_size)
+        return;
+
+    // median split of the box centers along the longer side of their bounds
+    Box centers;
+    for (std::size_t i = first; i < first + count; i++)
+    {
+        const Box& b = m_items[m_order[i]].box;
+        double x = 0.5 * (b.min_x + b.max_x);
+        double y = 0.5 * (b.min_y + b.max_y);
+        centers.add({ x, y, x, y });
+    }
+    bool along_x = centers.max_x - centers.min_x >= centers.max_y - centers.min_y;
+    auto center = [this, along_x](std::size_t i) {
+        const Box& b = m_items[i].box;
+        return along_x ? b.min_x + b.max_x : b.min_y + b.max_y;
+    };
+    std::size_t half = count / 2;
+    std::nth_element(m_order.begin() + first, m_order.begin() + first + half,
+                     m_order.begin() + first + count,
+                     [&center](std::size_t a, std::size_t b) { return center(a) < center(b); });
+
+    std::size_t left = m_nodes.size();
+    m_nodes.resize(left + 2);
+    m_nodes[node].left = left;
+    m_nodes[node].count = 0;
+    m_nodes[left].parent = node;
+    m_nodes[left + 1].parent = node;
+    m_nodes[left].first = first;
+    m_nodes[left].count = half;
+    m_nodes[left + 1].first = first + half;
+    m_nodes[left + 1].count = count - half;
+    split(left);
+    split(left + 1);
+}
+
+double SpatialIndex::refit()
+{
+    // children come after their parent
+    double sum = 0.0;
+    for (std::size_t n = m_nodes.size(); n-- > 0;)
+    {
+        fit(m_nodes[n]);
+        sum += m_nodes[n].box.extent();
+    }
+    return sum;
+}
+
+void SpatialIndex::fit(Node& node)
+{
+    node.box = Box();
+    if (node.count > 0)
+    {
+        for (std::size_t i = node.first; i < node.first + node.count; i++)
+            node.box.add(m_items[m_order[i]].box);
+    }
+    else
+    {
+        node.box.add(m_nodes[node.left].box);
+        node.box.add(m_nodes[node.left + 1].box);
+    }
+}
+
+void SpatialIndex::prepare()
+{
+    if (m_stale || m_rebuild)
+        refresh();
+    else if (!m_moved.empty())
+        refit_moved();
+}
+
+SpatialHit SpatialIndex::nearest_point(double x, double y, double max_distance)
+{
+    prepare();
+    SpatialHit hit;
+    hit.distance = max_distance;
+    if (m_nodes.empty())
+        return hit;
+    auto visit = [&hit, x, y](Entity* e, PointE* p) {
+        double d = std::hypot(p->x->value() - x, p->y->value() - y);
+        if (d <= hit.distance)
+        {
+            hit.entity = e;
+            hit.point = p;
+            hit.distance = d;
+        }
+    };
+    m_stack.assign(1, 0);
+    while (!m_stack.empty())
+    {
+        const Node& node = m_nodes[m_stack.back()];
+        m_stack.pop_back();
+        if (node.box.distance(x, y) > hit.distance)
+            continue;
+        if (node.count == 0)
+        {
+            // the nearer child is searched first so it can prune the other one
+            std::size_t near = node.left;
+            std::size_t far = node.left + 1;
+            if (m_nodes[far].box.distance(x, y) < m_nodes[near].box.distance(x, y))
+                std::swap(near, far);
+            m_stack.push_back(far);
+            m_stack.push_back(near);
+            continue;
+        }
+        for (std::size_t i = node.first; i < node.first + node.count; i++)
+        {
+            const Item& item = m_items[m_order[i]];
+            if (item.box.distance(x, y) > hit.distance)
+                continue;
+            switch (item.kind)
+            {
+            case PointKind:
+                visit(item.entity, static_cast<PointE*>(item.entity));
+                break;
+            case LineKind:
+                visit(item.entity, &static_cast<LineE*>(item.entity)->p0);
+                visit(item.entity, &static_cast<LineE*>(item.entity)->p1);
+                break;
+            case CircleKind:
+                visit(item.entity, &static_cast<CircleE*>(item.entity)->center());
+                break;
+            }
+        }
+    }
+    return hit;
+}
+
+void SpatialIndex::within_radius(double x, double y, double radius,
+                                 std::vector<SpatialHit>& hits)
+{
+    prepare();
+    hits.clear();
+    if (m_nodes.empty())
+        return;
+    m_stack.assign(1, 0);
+    while (!m_stack.empty())
+    {
+        const Node& node = m_nodes[m_stack.back()];
+        m_stack.pop_back();
+        if (node.box.distance(x, y) > radius)
+            continue;
+        if (node.count == 0)
+        {
+            m_stack.push_back(node.left);
+            m_stack.push_back(node.left + 1);
+            continue;
+        }
+        for (std::size_t i = node.first; i < node.first + node.count; i++)
+        {
+            const Item& item = m_items[m_order[i]];
+            if (item.box.distance(x, y) > radius)
+                continue;
+            SpatialHit hit;
+            hit.entity = item.entity;
+            switch (item.kind)
+            {
+            case PointKind:
+                hit.point = static_cast<PointE*>(item.entity);
+                hit.distance = std::hypot(hit.point->x->value() - x, hit.point->y->value() - y);
+                break;
+            case LineKind:
+            {
+                auto* l = static_cast<LineE*>(item.entity);
+                hit.distance = distance_to_segment(x, y, l->p0.x->value(), l->p0.y->value(),
+                                                   l->p1.x->value(), l->p1.y->value());
+                break;
+            }
+            case CircleKind:
+            {
+                auto* c = static_cast<CircleE*>(item.entity);
+                double d = std::hypot(c->center().x->value() - x, c->center().y->value() - y);
+                hit.distance = std::abs(d - std::abs(c->_radius->value()));
+                break;
+            }
+            }
+            if (hit.distance <= radius)
+                hits.push_back(hit);
+        }
+    }
+    std::sort(hits.begin(), hits.end(), by_distance);
+}
+
+void SpatialIndex::ray(double x, double y, double dx, double dy, double tolerance,
+                       std::vector<SpatialHit>& hits)
+{
+    prepare();
+    hits.clear();
+    double len = std::hypot(dx, dy);
+    if (m_nodes.empty() || len == 0.0)
+        return;
+    double ux = dx / len;
+    double uy = dy / len;
+    // slab test against a box grown by the tolerance
+    auto crosses = [=](const Box& b) {
+        double lo = 0.0;
+        double hi = infinity;
+        for (int axis = 0; axis < 2; axis++)
+        {
+            double o = axis == 0 ? x : y;
+            double u = axis == 0 ? ux : uy;
+            double min = (axis == 0 ? b.min_x : b.min_y) - tolerance;
+            double max = (axis == 0 ? b.max_x : b.max_y) + tolerance;
+            if (u == 0.0)
+            {
+                if (o < min || o > max)
+                    return false;
+                continue;
+            }
+            double t0 = (min - o) / u;
+            double t1 = (max - o) / u;
+            lo = std::max(lo, std::min(t0, t1));
+            hi = std::min(hi, std::max(t0, t1));
+        }
+        return lo <= hi;
+    };
+    m_stack.assign(1, 0);
+    while (!m_stack.empty())
+    {
+        const Node& node = m_nodes[m_stack.back()];
+        m_stack.pop_back();
+        if (!crosses(node.box))
+            continue;
+        if (node.count == 0)
+        {
+            m_stack.push_back(node.left);
+            m_stack.push_back(node.left + 1);
+            continue;
+        }
+        for (std::size_t i = node.first; i < node.first + node.count; i++)
+        {
+            const Item& item = m_items[m_order[i]];
+            if (!crosses(item.box))
+                continue;
+            SpatialHit hit;
+            hit.entity = item.entity;
+            switch (item.kind)
+            {
+            case PointKind:
+                hit.point = static_cast<PointE*>(item.entity);
+                hit.distance = ray_point(x, y, ux, uy, hit.point->x->value(),
+                                         hit.point->y->value(), tolerance);
+                break;
+            case LineKind:
+            {
+                auto* l = static_cast<LineE*>(item.entity);
+                hit.distance = ray_segment(x, y, ux, uy, l->p0.x->value(), l->p0.y->value(),
+                                           l->p1.x->value(), l->p1.y->value(), tolerance);
+                break;
+            }
+            case CircleKind:
+            {
+                auto* c = static_cast<CircleE*>(item.entity);
+                hit.distance = ray_circle(x, y, ux, uy, c->center().x->value(),
+                                          c->center().y->value(), std::abs(c->_radius->value()),
+                                          tolerance);
+                break;
+            }
+            }
+            if (hit.distance >= 0.0)
+                hits.push_back(hit);
+        }
+    }
+    std::sort(hits.begin(), hits.end(), by_distance);
+}
@@ -0,0 +1,183 @@
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+namespace
+{
+    // pool and deque index of the current thread if it is a pool worker
+    thread_local ThreadPool* tl_pool = nullptr;
+    thread_local std::size_t tl_index = 0;
+}
+
+ThreadPool::ThreadPool(std::size_t threads /* = 0 */)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    m_queues.reserve(threads);
+    for (std::size_t i = 0; i < threads; i++)
+        m_queues.push_back(std::make_unique<Queue>());
+    m_workers.reserve(threads);
+    for (std::size_t i = 0; i < threads; i++)
+        m_workers.emplace_back([this, i] { worker(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_sleep_cv.notify_all();
+    for (auto& t : m_workers)
+        t.join();
+}
+
+std::size_t ThreadPool::size() const
+{
+    return m_workers.size();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    std::size_t index = tl_pool == this ? tl_index : m_next_queue++ % m_queues.size();
+    // counted before it is queued so m_pending never underflows
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_pending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+        m_queues[index]->tasks.push_back(std::move(task));
+    }
+    m_sleep_cv.notify_one();
+}
+
+bool ThreadPool::pop(std::size_t index, std::function<void()>& task)
+{
+    auto& q = *m_queues[index];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty())
+        return false;
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(std::size_t thief, std::function<void()>& task)
+{
+    std::size_t n = m_queues.size();
+    for (std::size_t k = 1; k <= n; k++)
+    {
+        auto& q = *m_queues[(thief + k) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+            continue;
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::try_run_one()
+{
+    std::function<void()> task;
+    std::size_t index = tl_pool == this ? tl_index : 0;
+    if (!(tl_pool == this && pop(index, task)) && !steal(index, task))
+        return false;
+    m_pending--;
+    task();
+    return true;
+}
+
+void ThreadPool::worker(std::size_t index)
+{
+    tl_pool = this;
+    tl_index = index;
+    for (;;)
+    {
+        std::function<void()> task;
+        if (pop(index, task) || steal(index, task))
+        {
+            m_pending--;
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_sleep_cv.wait(lock, [this] { return m_stop || m_pending.load() > 0; });
+        if (m_stop && m_pending.load() == 0)
+            return;
+    }
+}
+
+namespace
+{
+    // shared with the helper tasks, which may only start after parallel_for returned
+    struct ParallelForState
+    {
+        std::size_t n;
+        std::size_t chunk;
+        std::size_t n_chunks;
+        const std::function<void(std::size_t, std::size_t)>* fn;
+        std::atomic<std::size_t> next{ 0 };
+        std::atomic<std::size_t> done{ 0 };
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        void run()
+        {
+            for (;;)
+            {
+                std::size_t i = next.fetch_add(1);
+                if (i >= n_chunks)
+                    return;
+                std::size_t begin = i * chunk;
+                (*fn)(begin, std::min(n, begin + chunk));
+                if (done.fetch_add(1) + 1 == n_chunks)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    cv.notify_all();
+                }
+            }
+        }
+    };
+}
+
+void ThreadPool::parallel_for(std::size_t n, std::size_t grain,
+                              const std::function<void(std::size_t, std::size_t)>& fn)
+{
+    if (n == 0)
+        return;
+    grain = std::max<std::size_t>(grain, 1);
+    // a few chunks per worker so uneven rows even out
+    std::size_t chunk = std::max(grain, n / (4 * (size() + 1)) + 1);
+    std::size_t n_chunks = (n + chunk - 1) / chunk;
+    if (n_chunks == 1)
+    {
+        fn(0, n);
+        return;
+    }
+
+    auto state = std::make_shared<ParallelForState>();
+    state->n = n;
+    state->chunk = chunk;
+    state->n_chunks = n_chunks;
+    state->fn = &fn;
+
+    std::size_t helpers = std::min(size(), n_chunks - 1);
+    for (std::size_t i = 0; i < helpers; i++)
+        submit([state] { state->run(); });
+
+    state->run();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&state] { return state->done.load() == state->n_chunks; });
+}